@@ -78,6 +78,242 @@ else
     error_occurred=1
 fi
 
+# Run the same file again with the other execution modes
+for EXECUTION_MODE in worker_pool fork_server; do
+    rm -f "$OUTPUT_FILE"
+    response2=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+        --header 'Content-Type: application/json' \
+        --data '{
+            "file_execution_path": "'$PYTHON_FILE_EXECUTION_PATH'",
+            "execution_mode": "'$EXECUTION_MODE'"
+        }')
+
+    if [[ "$response2" -ne 200 ]]; then
+        echo "The python file execution with $EXECUTION_MODE failed with status code: $response2"
+        cat /tmp/python-file-execution-res.log
+        error_occurred=1
+    fi
+
+    if [[ "$(cat "$OUTPUT_FILE" 2>/dev/null)" != "$EXPECTED_OUTPUT" ]]; then
+        echo "The output of the Python file with $EXECUTION_MODE does not match the expected output."
+        error_occurred=1
+    fi
+done
+
+# Scripts run by the cases below
+CASES_DIR=$(mktemp -d)
+trap 'rm -rf "$CASES_DIR"' EXIT
+cat >"$CASES_DIR/sleep.py" <<'EOF'
+import time
+time.sleep(1)
+EOF
+
+# Asynchronous execution: a job id right away, then its result once finished
+response3=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/sleep.py'",
+        "async": true
+    }')
+job_id=$(sed -n 's/.*"job_id" : "\([0-9a-f]*\)".*/\1/p' /tmp/python-file-execution-res.log)
+
+if [[ "$response3" -ne 202 || -z "$job_id" ]]; then
+    echo "The asynchronous python file execution failed with status code: $response3"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+else
+    for i in $(seq 1 60); do
+        if curl -s "http://127.0.0.1:$PORT/jobs/$job_id" | grep -q '"state" : "finished"'; then
+            break
+        fi
+        sleep 1
+    done
+    response4=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" "http://127.0.0.1:$PORT/jobs/$job_id/result")
+    if [[ "$response4" -ne 200 ]]; then
+        echo "The result of asynchronous job $job_id failed with status code: $response4"
+        cat /tmp/python-file-execution-res.log
+        error_occurred=1
+    fi
+fi
+
+# Admission control: with one execution running and no queue, the next one
+# is rejected with 429 and a Retry-After header
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_concurrent_executions": 1, "max_queued_executions": 0}'
+curl -s -o /dev/null "http://127.0.0.1:$PORT/execute" --header 'Content-Type: application/json' \
+    --data '{"file_execution_path": "'$CASES_DIR/sleep.py'", "async": true}'
+response5=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -D /tmp/python-file-execution-headers.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/sleep.py'"
+    }')
+
+if [[ "$response5" -ne 429 ]] || ! grep -qi '^Retry-After:' /tmp/python-file-execution-headers.log; then
+    echo "The python file execution beyond the admission limits was not rejected, status code: $response5"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_concurrent_executions": 0, "max_queued_executions": 256}'
+
+# Priorities: with one execution running, a queued interactive one starts
+# before a batch one queued earlier
+for PRIORITY in batch interactive; do
+    cat >"$CASES_DIR/$PRIORITY.py" <<EOF
+with open("$CASES_DIR/order.txt", "a") as file:
+    file.write("$PRIORITY\n")
+EOF
+done
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_concurrent_executions": 1}'
+# Prints the job id of an asynchronous execution of $1 with priority $2
+submit_job() {
+    curl -s "http://127.0.0.1:$PORT/execute" --header 'Content-Type: application/json' \
+        --data '{"file_execution_path": "'$1'", "priority": "'$2'", "async": true}' |
+        sed -n 's/.*"job_id" : "\([0-9a-f]*\)".*/\1/p'
+}
+job_ids=($(submit_job "$CASES_DIR/sleep.py" normal)
+         $(submit_job "$CASES_DIR/batch.py" batch)
+         $(submit_job "$CASES_DIR/interactive.py" interactive))
+for job_id in "${job_ids[@]}"; do
+    for i in $(seq 1 60); do
+        if curl -s "http://127.0.0.1:$PORT/jobs/$job_id" | grep -q '"state" : "finished"'; then
+            break
+        fi
+        sleep 1
+    done
+done
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_concurrent_executions": 0}'
+
+if [[ "$(cat "$CASES_DIR/order.txt" 2>/dev/null | tr '\n' ' ')" != "interactive batch " ]]; then
+    echo "Queued python file executions did not start by priority: $(cat "$CASES_DIR/order.txt" 2>/dev/null | tr '\n' ' ')"
+    error_occurred=1
+fi
+
+# Timeouts: a script outliving "timeout_ms" fails with 504 and "timed_out"
+for EXECUTION_MODE in spawn worker_pool fork_server; do
+    response6=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+        --header 'Content-Type: application/json' \
+        --data '{
+            "file_execution_path": "'$CASES_DIR/sleep.py'",
+            "execution_mode": "'$EXECUTION_MODE'",
+            "timeout_ms": 200
+        }')
+
+    if [[ "$response6" -ne 504 ]] || ! grep -q '"timed_out" : true' /tmp/python-file-execution-res.log; then
+        echo "The python file execution with $EXECUTION_MODE did not time out, status code: $response6"
+        cat /tmp/python-file-execution-res.log
+        error_occurred=1
+    fi
+done
+
+# Subinterpreters run on Python 3.12 or later and are refused before
+SUBINTERPRETERS=$(./engines/cortex.python/python/bin/python3 -c 'import sys; print(int(sys.version_info >= (3, 12)))')
+response7=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/sleep.py'",
+        "execution_mode": "subinterpreter"
+    }')
+
+if [[ "$SUBINTERPRETERS" -eq 1 && "$response7" -ne 200 ]]; then
+    echo "The python file execution with subinterpreter failed with status code: $response7"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+elif [[ "$SUBINTERPRETERS" -ne 1 ]] && ! grep -q "subinterpreters are not available" /tmp/python-file-execution-res.log; then
+    echo "The python file execution with subinterpreter was not refused on Python before 3.12, status code: $response7"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+# Output capture: what the script writes comes back, cut at "max_output_bytes"
+cat >"$CASES_DIR/output.py" <<'EOF'
+import sys
+print("captured")
+sys.stderr.write("x" * 100)
+EOF
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_output_bytes": 50}'
+response8=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/output.py'",
+        "capture_output": true
+    }')
+curl -s -o /dev/null "http://127.0.0.1:$PORT/config" --header 'Content-Type: application/json' \
+    --data '{"max_output_bytes": 1048576}'
+
+if [[ "$response8" -ne 200 ]] || ! grep -q '"stdout" : "captured\\n"' /tmp/python-file-execution-res.log ||
+    ! grep -q '"stderr_truncated" : true' /tmp/python-file-execution-res.log; then
+    echo "The python file execution did not capture its output, status code: $response8"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+# Streaming: output events while the script runs, then a result event. A
+# request rejected before it runs gets a plain JSON response.
+response9=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -N -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/output.py'",
+        "stream": true
+    }')
+
+if [[ "$response9" -ne 200 ]] || ! grep -q '^data: {"data":"captured' /tmp/python-file-execution-res.log ||
+    ! grep -q '^event: result' /tmp/python-file-execution-res.log; then
+    echo "The streamed python file execution failed with status code: $response9"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+response10=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/output.py'",
+        "stream": true,
+        "async": true
+    }')
+
+if [[ "$response10" -ne 400 ]]; then
+    echo "The invalid streamed python file execution was not rejected, status code: $response10"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+# Shared blobs: inputs are read from shared memory, outputs come back base64
+# encoded
+cat >"$CASES_DIR/blobs.py" <<'EOF'
+import cortex_blobs
+cortex_blobs.set_output("upper", bytes(cortex_blobs.inputs["text"]).upper())
+EOF
+response11=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute" \
+    --header 'Content-Type: application/json' \
+    --data '{
+        "file_execution_path": "'$CASES_DIR/blobs.py'",
+        "inputs": { "text": "'$(printf 'cortex' | base64)'" }
+    }')
+
+if [[ "$response11" -ne 200 ]] || ! grep -q '"upper" : "'$(printf 'CORTEX' | base64)'"' /tmp/python-file-execution-res.log; then
+    echo "The python file execution with blobs failed with status code: $response11"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+# Inline code: the source is the body of /execute/code, the other fields are
+# query parameters
+response12=$(curl --connect-timeout 60 -o /tmp/python-file-execution-res.log -s -w "%{http_code}" --location "http://127.0.0.1:$PORT/execute/code?capture_output=true" \
+    --header 'Content-Type: text/x-python' \
+    --data-binary 'print(6 * 7)')
+
+if [[ "$response12" -ne 200 ]] || ! grep -q '"stdout" : "42\\n"' /tmp/python-file-execution-res.log; then
+    echo "The inline python code execution failed with status code: $response12"
+    cat /tmp/python-file-execution-res.log
+    error_occurred=1
+fi
+
+# Arrow tables (HandlePythonTableExecutionRequest) are only reachable by C++
+# callers of the engine, the server has no route for them to test here
 
 if [[ "$error_occurred" -eq 1 ]]; then
     echo "Server test run failed!!!!!!!!!!!!!!!!!!!!!!"
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Arrow C Data Interface, see
+// https://arrow.apache.org/docs/format/CDataInterface.html. The guard lets it
+// coexist with the definitions of Arrow itself.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+// Named record batch exchanged with the engine: a struct array ("+s") whose
+// children are the columns, with its schema. It releases both when
+// destroyed, moving it hands them over.
+struct CortexArrowTable {
+  std::string name;
+  ArrowSchema schema{};
+  ArrowArray array{};
+
+  CortexArrowTable() = default;
+  CortexArrowTable(std::string name, ArrowSchema schema, ArrowArray array)
+      : name(std::move(name)), schema(schema), array(array) {}
+
+  CortexArrowTable(CortexArrowTable&& other) noexcept
+      : name(std::move(other.name)), schema(other.schema), array(other.array) {
+    other.schema.release = nullptr;
+    other.array.release = nullptr;
+  }
+
+  CortexArrowTable& operator=(CortexArrowTable&& other) noexcept {
+    if (this != &other) {
+      Release();
+      name = std::move(other.name);
+      schema = other.schema;
+      array = other.array;
+      other.schema.release = nullptr;
+      other.array.release = nullptr;
+    }
+    return *this;
+  }
+
+  CortexArrowTable(const CortexArrowTable&) = delete;
+  CortexArrowTable& operator=(const CortexArrowTable&) = delete;
+
+  ~CortexArrowTable() { Release(); }
+
+  void Release() {
+    if (array.release) {
+      array.release(&array);
+    }
+    if (schema.release) {
+      schema.release(&schema);
+    }
+  }
+};
@@ -2,7 +2,9 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
+#include "base/cortex-common/cortex_arrow.h"
 #include "json/value.h"
 
 class CortexPythonEngineI {
@@ -10,7 +12,11 @@ class CortexPythonEngineI {
   virtual ~CortexPythonEngineI() {}
 
   virtual bool IsSupported(const std::string& f) {
-    if (f == "ExecutePythonFile" || f == "HandlePythonFileExecutionRequest") {
+    if (f == "ExecutePythonFile" || f == "HandlePythonFileExecutionRequest" ||
+        f == "HandlePythonFileStreamingRequest" || f == "HandlePythonTableExecutionRequest" ||
+        f == "HandleJobStatusRequest" || f == "HandleJobResultRequest" ||
+        f == "RunPythonWorker" || f == "RunPythonForkServer" || f == "RunPythonChildProcess" ||
+        f == "HandleEngineConfigRequest" || f == "HandleEngineStatsRequest") {
       return true;
     }
     return false;
@@ -20,7 +26,61 @@ class CortexPythonEngineI {
                                  std::string file_execution_path,
                                  std::string python_library_path) = 0;
 
+  // `callback` may be called from an engine thread after this returns, once
+  // the execution is done
   virtual void HandlePythonFileExecutionRequest(
       std::shared_ptr<Json::Value> json_body,
       std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
+
+  // Like HandlePythonFileExecutionRequest, with the stdout and stderr of the
+  // execution passed to `on_output` as {"stream", "data"} chunks while it
+  // runs instead of being returned. Every chunk comes before `callback`.
+  // Returns false when the request is rejected before it runs, `callback`
+  // already got the error then and no chunk follows.
+  virtual bool HandlePythonFileStreamingRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::function<void(Json::Value&&)>&& on_output,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
+
+  // Like HandlePythonFileExecutionRequest, with `tables` handed to the script
+  // as cortex_blobs.tables through shared memory. Their buffers are copied
+  // once and released before this returns. The tables the script sets come
+  // back to `callback`, their buffers pointing into that memory except for
+  // the offsets, which are copied.
+  virtual void HandlePythonTableExecutionRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::vector<CortexArrowTable>&& tables,
+      std::function<void(Json::Value&&, Json::Value&&, std::vector<CortexArrowTable>&&)>&& callback) = 0;
+
+  // State of an asynchronous execution, json_body carries its "job_id"
+  virtual void HandleJobStatusRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
+
+  // Outcome of a finished asynchronous execution, json_body carries its "job_id"
+  virtual void HandleJobResultRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
+
+  // Entry point of a warm worker process, returns its exit code
+  virtual int RunPythonWorker(std::string binary_execute_path,
+                              std::string python_library_path) = 0;
+
+  // Entry point of a fork server (zygote) process, returns its exit code
+  virtual int RunPythonForkServer(std::string binary_execute_path,
+                                  std::string python_library_path) = 0;
+
+  // Entry point of a child process of the engine running in the binary of
+  // the server, when the engine has no cortex-python-runner. `argv` is the
+  // command line the engine spawned it with, returns its exit code.
+  virtual int RunPythonChildProcess(std::string binary_execute_path, int argc, char** argv) = 0;
+
+  virtual void HandleEngineConfigRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
+
+  // Statistics gathered over the executions, such as their import costs
+  virtual void HandleEngineStatsRequest(
+      std::shared_ptr<Json::Value> json_body,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) = 0;
 };
@@ -0,0 +1,205 @@
+// Measures the spawn-to-exec latency of every way the engine can start a
+// child process, from a parent of configurable size:
+//
+//   spawn-benchmark [--iterations N] [--rss-mb MB] [--exe PATH]
+//
+// The latency runs from the spawn call until the child exec'd, which the
+// parent sees as EOF on a close-on-exec pipe held by the child.
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "json/value.h"
+#include "src/process_spawn.h"
+#include "src/python_worker_protocol.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  int iterations = 200;
+  size_t rss_mb = 0;
+  std::string exe_path = "/bin/true";
+};
+
+// Blocks until every copy of the write end of the pipe is closed
+void WaitForExec(int read_fd) {
+  char c;
+  while (read(read_fd, &c, 1) > 0 || errno == EINTR) {
+  }
+}
+
+// Forks and execs on request, the same way the fork server forks children
+// from a process which stayed small
+void RunForkHelper(int channel_fd, const std::string& exe_path) {
+  signal(SIGCHLD, SIG_IGN);
+  python_worker::MessageChannel channel(channel_fd);
+  Json::Value msg;
+  std::vector<int> fds;
+  while (channel.Receive(msg, fds)) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      // fds[0] is close-on-exec
+      execl(exe_path.c_str(), exe_path.c_str(), nullptr);
+      _exit(127);
+    }
+    for (int fd : fds) {
+      close(fd);
+    }
+  }
+  _exit(0);
+}
+
+struct Result {
+  std::string name;
+  std::vector<double> latencies_us;
+};
+
+void PrintResult(Result& result) {
+  auto& l = result.latencies_us;
+  if (l.empty()) {
+    printf("%-18s failed\n", result.name.c_str());
+    return;
+  }
+  std::sort(l.begin(), l.end());
+  double sum = 0;
+  for (double v : l) {
+    sum += v;
+  }
+  printf("%-18s min %8.1f  p50 %8.1f  p99 %8.1f  mean %8.1f us\n", result.name.c_str(),
+         l.front(), l[l.size() / 2], l[std::min(l.size() - 1, l.size() * 99 / 100)],
+         sum / l.size());
+}
+
+Result BenchmarkSpawnStrategy(const char* name, process_spawn::SpawnStrategy strategy,
+                              const Options& options) {
+  Result result{name, {}};
+  for (int i = 0; i < options.iterations; i++) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      break;
+    }
+    pid_t pid;
+    auto start = Clock::now();
+    // The write end stays open in the child until exec closes it
+    int status = process_spawn::SpawnProcess(strategy, options.exe_path, {},
+                                             {{fds[1], fds[1]}}, pid);
+    close(fds[1]);
+    if (status == 0) {
+      WaitForExec(fds[0]);
+      result.latencies_us.push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+      waitpid(pid, nullptr, 0);
+    } else {
+      fprintf(stderr, "%s: %s\n", name, strerror(status));
+    }
+    close(fds[0]);
+    if (status) {
+      break;
+    }
+  }
+  return result;
+}
+
+Result BenchmarkForkServer(python_worker::MessageChannel& channel, const Options& options) {
+  Result result{"fork_server", {}};
+  Json::Value job;
+  job["exec"] = true;
+  for (int i = 0; i < options.iterations; i++) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      break;
+    }
+    auto start = Clock::now();
+    bool sent = channel.Send(job, {fds[1]});
+    close(fds[1]);
+    if (sent) {
+      WaitForExec(fds[0]);
+      result.latencies_us.push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    close(fds[0]);
+    if (!sent) {
+      break;
+    }
+  }
+  return result;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string arg = argv[i];
+    if (arg == "--iterations") {
+      options.iterations = std::max(1, atoi(argv[i + 1]));
+    } else if (arg == "--rss-mb") {
+      options.rss_mb = strtoul(argv[i + 1], nullptr, 10);
+    } else if (arg == "--exe") {
+      options.exe_path = argv[i + 1];
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    fprintf(stderr, "Usage: %s [--iterations N] [--rss-mb MB] [--exe PATH]\n", argv[0]);
+    return 1;
+  }
+
+  // The helper is forked before the parent grows, like the fork server which
+  // is started before the engine serves requests
+  int channel_fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel_fds) != 0) {
+    perror("socketpair");
+    return 1;
+  }
+  pid_t helper_pid = fork();
+  if (helper_pid == 0) {
+    close(channel_fds[0]);
+    RunForkHelper(channel_fds[1], options.exe_path);
+  }
+  close(channel_fds[1]);
+  python_worker::MessageChannel channel(channel_fds[0]);
+
+  // Touch every page, so the parent really has this resident set
+  std::vector<char> ballast(options.rss_mb << 20);
+  for (size_t i = 0; i < ballast.size(); i += 4096) {
+    ballast[i] = 1;
+  }
+
+  printf("%d iterations of %s from a parent with %zu MB of ballast\n", options.iterations,
+         options.exe_path.c_str(), options.rss_mb);
+  std::vector<Result> results;
+  results.push_back(BenchmarkSpawnStrategy(process_spawn::kSpawnStrategyPosixSpawn,
+                                           process_spawn::SpawnStrategy::kPosixSpawn, options));
+  results.push_back(BenchmarkSpawnStrategy(process_spawn::kSpawnStrategyPosixSpawnVfork,
+                                           process_spawn::SpawnStrategy::kPosixSpawnVfork,
+                                           options));
+  results.push_back(BenchmarkSpawnStrategy(process_spawn::kSpawnStrategyCloneVfork,
+                                           process_spawn::SpawnStrategy::kCloneVfork, options));
+  results.push_back(BenchmarkForkServer(channel, options));
+  for (auto& result : results) {
+    PrintResult(result);
+  }
+
+  close(channel_fds[0]);
+  waitpid(helper_pid, nullptr, 0);
+  return 0;
+}
@@ -3,12 +3,14 @@
 #include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <set>
 #include <signal.h>
 
 #include "dylib.h"
 #include "httplib.h"
 #include "json/reader.h"
 #include "json/forwards.h"
+#include "json/writer.h"
 #include "base/cortex-common/cortexpythoni.h"
 #include "trantor/utils/Logger.h"
 
@@ -51,6 +53,70 @@ class Server {
     std::queue<std::pair<Json::Value, Json::Value>> q;
   };
 
+  // Events of a streamed execution: its output chunks, then its result.
+  // Output queued for a client reading slower than the script writes is
+  // capped, what does not fit is dropped.
+  struct StreamQueue {
+    static constexpr size_t kMaxQueuedOutputBytes = 4 * 1024 * 1024;
+
+    struct Event {
+      std::string name;
+      Json::Value status;
+      Json::Value data;
+    };
+
+    void Push(Event&& event) {
+      std::unique_lock<std::mutex> l(mtx);
+      // Nobody reads the events of a client which went away
+      if (abandoned) {
+        return;
+      }
+      if (event.name == "output") {
+        const std::string stream = event.data.get("stream", "").asString();
+        size_t size = event.data.get("data", "").asString().size();
+        if (overflowed || queued_output_bytes + size > kMaxQueuedOutputBytes) {
+          // Everything after is dropped, each stream says once that it is cut
+          overflowed = true;
+          if (!truncated_streams.insert(stream).second) {
+            return;
+          }
+          event.data = Json::Value();
+          event.data["stream"] = stream;
+          event.data["truncated"] = true;
+          size = 0;
+        }
+        queued_output_bytes += size;
+      }
+      q.push(std::move(event));
+      cond.notify_one();
+    }
+
+    Event WaitAndPop() {
+      std::unique_lock<std::mutex> l(mtx);
+      cond.wait(l, [this] { return !q.empty(); });
+      auto res = std::move(q.front());
+      q.pop();
+      if (res.name == "output") {
+        queued_output_bytes -= res.data.get("data", "").asString().size();
+      }
+      return res;
+    }
+
+    void Abandon() {
+      std::unique_lock<std::mutex> l(mtx);
+      abandoned = true;
+      q = {};
+    }
+
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::queue<Event> q;
+    size_t queued_output_bytes = 0;
+    bool overflowed = false;
+    std::set<std::string> truncated_streams;
+    bool abandoned = false;
+  };
+
 private:
   std::unique_ptr<dylib> dylib_;
   CortexPythonEngineI* engine_;
@@ -72,19 +138,19 @@ inline void SignalHandler(int signal) {
 }
 
 using SyncQueue = Server::SyncQueue;
+using StreamQueue = Server::StreamQueue;
 
 int main(int argc, char** argv) {
   
   Server server;
 
-  // Check if this process is for python execution
-  if (argc > 1) {
-    if (strcmp(argv[1], "--run_python_file") == 0) {
-        std::string py_home_path = (argc > 3) ? argv[3] : "";
-        server.GetEngine()->ExecutePythonFile(argv[0], argv[2], py_home_path);
-        return 0;
-    }
-  } 
+  // Check if this process is a child of the engine, which spawns the server
+  // binary when it has no cortex-python-runner
+  if (argc > 1 && (strcmp(argv[1], "--run_python_file") == 0 ||
+                   strcmp(argv[1], "--run_python_worker") == 0 ||
+                   strcmp(argv[1], "--run_python_zygote") == 0)) {
+    return server.GetEngine()->RunPythonChildProcess(argv[0], argc, argv);
+  }
 
   // This process is for running the server
   std::string hostname = (argc > 1) ? argv[1] : "127.0.0.1";
@@ -99,12 +165,140 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  const auto handle_file_execution = [&r, &server](const httplib::Request& req, httplib::Response& resp) {
+  // Server-Sent Events: "output" events carrying {"stream", "data"} chunks,
+  // then a "result" event with the response and its "status_code". Requests
+  // rejected before they run are answered like unstreamed ones.
+  const auto handle_streaming_execution = [&server](std::shared_ptr<Json::Value> req_body,
+                                                    httplib::Response& resp) {
+    auto q = std::make_shared<StreamQueue>();
+    bool admitted = server.GetEngine()->HandlePythonFileStreamingRequest(
+        req_body,
+        [q](Json::Value&& output) {
+          q->Push({"output", Json::Value(), std::move(output)});
+        },
+        [q](Json::Value status, Json::Value res) {
+          res["status_code"] = status["status_code"];
+          q->Push({"result", std::move(status), std::move(res)});
+        });
+
+    if (!admitted) {
+      auto rejection = q->WaitAndPop();
+      rejection.data.removeMember("status_code");
+      resp.set_content(rejection.data.toStyledString().c_str(),
+                       "application/json; charset=utf-8");
+      resp.status = rejection.status["status_code"].asInt();
+      if (rejection.status.isMember("retry_after")) {
+        resp.set_header("Retry-After", std::to_string(rejection.status["retry_after"].asInt()));
+      }
+      return;
+    }
+
+    resp.set_header("Cache-Control", "no-cache");
+    resp.set_chunked_content_provider(
+        "text/event-stream",
+        [q](size_t, httplib::DataSink& sink) {
+          auto event = q->WaitAndPop();
+          Json::StreamWriterBuilder writer;
+          writer["indentation"] = "";
+          std::string message = "event: " + event.name + "\ndata: " +
+                                Json::writeString(writer, event.data) + "\n\n";
+          if (!sink.write(message.data(), message.size())) {
+            return false;
+          }
+          if (event.name == "result") {
+            sink.done();
+          }
+          return true;
+        },
+        [q](bool success) {
+          if (!success) {
+            q->Abandon();
+          }
+        });
+  };
+
+  const auto handle_execution = [&server, &handle_streaming_execution](std::shared_ptr<Json::Value> req_body,
+                                                                        httplib::Response& resp) {
+    if (req_body->get("stream", false).asBool()) {
+      handle_streaming_execution(req_body, resp);
+      return;
+    }
+    // The engine may call back from its own thread once the script is done
+    auto q = std::make_shared<SyncQueue>();
+    server.GetEngine()->HandlePythonFileExecutionRequest(
+        req_body, [q](Json::Value status, Json::Value res) {
+          q->Push(std::make_pair(status, res));
+        });
+    auto [status, res] = q->WaitAndPop();
+    resp.set_content(res.toStyledString().c_str(),
+                     "application/json; charset=utf-8");
+    resp.status = status["status_code"].asInt();
+    if (status.isMember("retry_after")) {
+      resp.set_header("Retry-After", std::to_string(status["retry_after"].asInt()));
+    }
+  };
+
+  const auto handle_file_execution = [&r, &handle_execution](const httplib::Request& req, httplib::Response& resp) {
     resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
     auto req_body = std::make_shared<Json::Value>();
     r.parse(req.body, *req_body);
-    server.GetEngine()->HandlePythonFileExecutionRequest(
-        req_body, [&server, &resp](Json::Value status, Json::Value res) {
+    handle_execution(req_body, resp);
+  };
+
+  // The body is the source to run, the other fields of the request come as
+  // query parameters, e.g. POST /execute/code?capture_output=true
+  const auto handle_code_execution = [&r, &handle_execution](const httplib::Request& req, httplib::Response& resp) {
+    resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
+    auto req_body = std::make_shared<Json::Value>(Json::objectValue);
+    for (const auto& [name, value] : req.params) {
+      // Parameters holding JSON keep their type, anything else is a string
+      Json::Value parsed;
+      (*req_body)[name] = r.parse(value, parsed) ? parsed : Json::Value(value);
+    }
+    (*req_body)["code"] = req.body;
+    handle_execution(req_body, resp);
+  };
+
+  const auto handle_engine_config = [&r, &server](const httplib::Request& req, httplib::Response& resp) {
+    resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
+    auto req_body = std::make_shared<Json::Value>();
+    r.parse(req.body, *req_body);
+    server.GetEngine()->HandleEngineConfigRequest(
+        req_body, [&resp](Json::Value status, Json::Value res) {
+          resp.set_content(res.toStyledString().c_str(),
+                           "application/json; charset=utf-8");
+          resp.status = status["status_code"].asInt();
+        });
+  };
+
+  const auto handle_job_status = [&server](const httplib::Request& req, httplib::Response& resp) {
+    resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
+    auto req_body = std::make_shared<Json::Value>();
+    (*req_body)["job_id"] = req.matches[1].str();
+    server.GetEngine()->HandleJobStatusRequest(
+        req_body, [&resp](Json::Value status, Json::Value res) {
+          resp.set_content(res.toStyledString().c_str(),
+                           "application/json; charset=utf-8");
+          resp.status = status["status_code"].asInt();
+        });
+  };
+
+  const auto handle_job_result = [&server](const httplib::Request& req, httplib::Response& resp) {
+    resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
+    auto req_body = std::make_shared<Json::Value>();
+    (*req_body)["job_id"] = req.matches[1].str();
+    server.GetEngine()->HandleJobResultRequest(
+        req_body, [&resp](Json::Value status, Json::Value res) {
+          resp.set_content(res.toStyledString().c_str(),
+                           "application/json; charset=utf-8");
+          resp.status = status["status_code"].asInt();
+        });
+  };
+
+  const auto handle_engine_stats = [&server](const httplib::Request& req, httplib::Response& resp) {
+    resp.set_header("Access-Control-Allow-Origin", req.get_header_value("Origin"));
+    server.GetEngine()->HandleEngineStatsRequest(
+        std::make_shared<Json::Value>(), [&resp](Json::Value status, Json::Value res) {
           resp.set_content(res.toStyledString().c_str(),
                            "application/json; charset=utf-8");
           resp.status = status["status_code"].asInt();
@@ -112,6 +306,11 @@ int main(int argc, char** argv) {
   };
 
   svr->Post("/execute", handle_file_execution);
+  svr->Post("/execute/code", handle_code_execution);
+  svr->Get(R"(/jobs/([0-9a-f]+))", handle_job_status);
+  svr->Get(R"(/jobs/([0-9a-f]+)/result)", handle_job_result);
+  svr->Post("/config", handle_engine_config);
+  svr->Get("/stats", handle_engine_stats);
 
   LOG_INFO << "HTTP server listening: " << hostname << ":" << port;
   svr->new_task_queue = [] {
@@ -0,0 +1,99 @@
+"""Packs the compiled standard library, and the listed site-packages, into a
+single image which the engine maps and imports from without touching the
+loose tree.
+
+Usage: pack_python_stdlib.py <lib/python3.x> <output> [package...]
+
+Run it with the interpreter the image is meant for, its bytecode is only
+valid for that version. Packages shipping extension modules must stay in
+the loose tree, which the image does not replace: modules keep the paths of
+their sources there for data files and tracebacks.
+
+Layout: b"CXPYSTD1", the 4 byte bytecode magic number, the little endian
+length of the marshalled index, the index, then the marshalled code objects.
+The index maps module names to (offset after the index, size, is_package,
+source path relative to lib/python3.x).
+"""
+import importlib.util
+import marshal
+import os
+import struct
+import sys
+
+HEADER = b"CXPYSTD1"
+
+# Not imported by scripts, or not importable from their sources alone
+EXCLUDED = {
+    "site-packages", "lib-dynload", "__pycache__", "test", "idlelib", "tkinter",
+    "turtledemo", "ensurepip", "lib2to3", "venv",
+}
+
+
+def walk(lib_dir, relative_path, name, modules):
+    path = os.path.join(lib_dir, relative_path)
+    if os.path.isdir(path):
+        init = os.path.join(relative_path, "__init__.py")
+        if not os.path.isfile(os.path.join(lib_dir, init)):
+            return
+        modules.append((name, init, True))
+        for entry in sorted(os.listdir(path)):
+            if entry in EXCLUDED:
+                continue
+            child = os.path.join(relative_path, entry)
+            if entry.endswith(".py") and entry != "__init__.py":
+                modules.append((name + "." + entry[:-3], child, False))
+            elif entry.isidentifier():
+                walk(lib_dir, child, name + "." + entry, modules)
+    elif path.endswith(".py"):
+        modules.append((name, relative_path, False))
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    lib_dir, output, packages = sys.argv[1], sys.argv[2], sys.argv[3:]
+
+    modules = []
+    for entry in sorted(os.listdir(lib_dir)):
+        if entry in EXCLUDED or entry.startswith("config-"):
+            continue
+        if entry.endswith(".py") and entry[:-3].isidentifier():
+            walk(lib_dir, entry, entry[:-3], modules)
+        elif entry.isidentifier():
+            walk(lib_dir, entry, entry, modules)
+    for package in packages:
+        relative_path = os.path.join("site-packages", package)
+        if not os.path.exists(os.path.join(lib_dir, relative_path)):
+            relative_path += ".py"
+        walk(lib_dir, relative_path, package, modules)
+
+    blobs = []
+    index = {}
+    offset = 0
+    for name, relative_path, is_package in modules:
+        with open(os.path.join(lib_dir, relative_path), "rb") as source:
+            try:
+                code = compile(source.read(), relative_path, "exec", dont_inherit=True, optimize=0)
+            except SyntaxError as e:
+                print("Skipping %s: %s" % (relative_path, e), file=sys.stderr)
+                continue
+        blob = marshal.dumps(code)
+        index[name] = (offset, len(blob), is_package, relative_path.replace(os.sep, "/"))
+        blobs.append(blob)
+        offset += len(blob)
+
+    marshalled_index = marshal.dumps(index)
+    tmp_output = output + ".tmp"
+    with open(tmp_output, "wb") as image:
+        image.write(HEADER)
+        image.write(importlib.util.MAGIC_NUMBER)
+        image.write(struct.pack("<I", len(marshalled_index)))
+        image.write(marshalled_index)
+        for blob in blobs:
+            image.write(blob)
+    os.replace(tmp_output, output)
+    print("Packed %d modules into %s" % (len(index), output))
+
+
+if __name__ == "__main__":
+    main()
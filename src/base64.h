@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace python_utils {
+
+// Standard base64 (RFC 4648) with padding, for binary payloads in JSON
+inline std::string Base64Encode(const char* data, size_t size) {
+  static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  auto bytes = reinterpret_cast<const unsigned char*>(data);
+  std::string encoded;
+  encoded.reserve((size + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < size; i += 3) {
+    uint32_t n = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+    encoded += kAlphabet[n >> 18];
+    encoded += kAlphabet[(n >> 12) & 63];
+    encoded += kAlphabet[(n >> 6) & 63];
+    encoded += kAlphabet[n & 63];
+  }
+  if (i < size) {
+    uint32_t n = bytes[i] << 16;
+    if (i + 1 < size) {
+      n |= bytes[i + 1] << 8;
+    }
+    encoded += kAlphabet[n >> 18];
+    encoded += kAlphabet[(n >> 12) & 63];
+    encoded += i + 1 < size ? kAlphabet[(n >> 6) & 63] : '=';
+    encoded += '=';
+  }
+  return encoded;
+}
+
+// Bytes `encoded` decodes to, when it is valid base64
+inline size_t Base64DecodedSize(const std::string& encoded) {
+  if (encoded.size() % 4 != 0) {
+    return 0;
+  }
+  size_t size = encoded.size() / 4 * 3;
+  if (!encoded.empty() && encoded.back() == '=') {
+    size -= encoded[encoded.size() - 2] == '=' ? 2 : 1;
+  }
+  return size;
+}
+
+// Whether `encoded` is valid base64
+inline bool IsBase64(const std::string& encoded) {
+  if (encoded.size() % 4 != 0) {
+    return false;
+  }
+  size_t padding = 0;
+  if (!encoded.empty() && encoded.back() == '=') {
+    padding = encoded[encoded.size() - 2] == '=' ? 2 : 1;
+  }
+  for (size_t i = 0; i < encoded.size() - padding; i++) {
+    char c = encoded[i];
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '+' && c != '/') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes `encoded` into `out`, which holds Base64DecodedSize bytes. Returns
+// false when it is not valid base64.
+inline bool Base64Decode(const std::string& encoded, char* out) {
+  auto value = [](char c) -> int {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+  };
+  if (encoded.size() % 4 != 0) {
+    return false;
+  }
+  size_t written = 0;
+  for (size_t i = 0; i < encoded.size(); i += 4) {
+    bool last = i + 4 == encoded.size();
+    int padding = last && encoded[i + 3] == '=' ? 1 + (encoded[i + 2] == '=') : 0;
+    uint32_t n = 0;
+    for (int j = 0; j < 4; j++) {
+      int v = j >= 4 - padding ? 0 : value(encoded[i + j]);
+      if (v < 0) {
+        return false;
+      }
+      n = (n << 6) | v;
+    }
+    out[written++] = static_cast<char>(n >> 16);
+    if (padding < 2) {
+      out[written++] = static_cast<char>((n >> 8) & 0xFF);
+    }
+    if (padding < 1) {
+      out[written++] = static_cast<char>(n & 0xFF);
+    }
+  }
+  return true;
+}
+
+} // namespace python_utils
@@ -0,0 +1,185 @@
+#pragma once
+
+namespace cgroup {
+class CgroupManager;
+} // namespace cgroup
+
+#if defined(__linux__)
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "trantor/utils/Logger.h"
+
+namespace cgroup {
+
+// CPU bandwidth period written to cpu.max, the quota is a share of it
+constexpr const int64_t kCpuPeriodUs = 100000;
+
+// Writes `value` to the cgroup interface file `path`, returns false and
+// keeps errno on failure
+inline bool WriteCgroupFile(const std::string& path, const std::string& value) {
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return written;
+}
+
+// Moves the calling process into the cgroup `leaf_path`. Only uses
+// async-signal-safe calls, so it can run in a freshly forked child.
+inline bool JoinCgroup(const char* leaf_path) {
+  char path[4096];
+  size_t len = strlen(leaf_path);
+  const char kProcs[] = "/cgroup.procs";
+  if (len + sizeof(kProcs) > sizeof(path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  memcpy(path, leaf_path, len);
+  memcpy(path + len, kProcs, sizeof(kProcs));
+
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // Writing 0 moves the writer itself
+  bool written = write(fd, "0", 1) == 1;
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return written;
+}
+
+// Creates a cgroup v2 leaf per execution under a delegated subtree, so one
+// script cannot starve the others of CPU, memory or process slots. The
+// server must have write access to the subtree and must not run inside its
+// root, which only holds the execution leaves.
+class CgroupManager {
+ public:
+  explicit CgroupManager(std::string root_path) : root_path_(std::move(root_path)) {
+    while (root_path_.size() > 1 && root_path_.back() == '/') {
+      root_path_.pop_back();
+    }
+  }
+
+  ~CgroupManager() {
+    std::lock_guard<std::mutex> l(mtx_);
+    RemoveStaleLeaves();
+  }
+
+  const std::string& root_path() const { return root_path_; }
+
+  // Creates a leaf limited to `cpu_quota` CPUs, `memory_limit_mb` MB of
+  // memory without swap and `pids_max` processes, 0 meaning no limit. Fills
+  // `leaf_path` and returns true once the leaf is ready for a process.
+  bool CreateLeaf(double cpu_quota, int64_t memory_limit_mb, int64_t pids_max,
+                  std::string& leaf_path) {
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      RemoveStaleLeaves();
+      if (!controllers_enabled_ && !EnableControllers()) {
+        return false;
+      }
+    }
+
+    leaf_path = root_path_ + "/exec-" + std::to_string(getpid()) + "-" +
+                std::to_string(next_leaf_id_++);
+    if (mkdir(leaf_path.c_str(), 0755) != 0) {
+      LOG_ERROR << "Failed to create cgroup " << leaf_path << ": " << strerror(errno);
+      return false;
+    }
+
+    bool limited = true;
+    if (cpu_quota > 0) {
+      auto quota_us = std::max<int64_t>(1000, static_cast<int64_t>(cpu_quota * kCpuPeriodUs));
+      limited &= WriteLimit(leaf_path, "cpu.max",
+                            std::to_string(quota_us) + " " + std::to_string(kCpuPeriodUs));
+    }
+    if (memory_limit_mb > 0) {
+      limited &= WriteLimit(leaf_path, "memory.max", std::to_string(memory_limit_mb << 20));
+      // Swap is optional in the kernel, without it there is nothing to limit
+      if (access((leaf_path + "/memory.swap.max").c_str(), F_OK) == 0) {
+        limited &= WriteLimit(leaf_path, "memory.swap.max", "0");
+      }
+    }
+    if (pids_max > 0) {
+      limited &= WriteLimit(leaf_path, "pids.max", std::to_string(pids_max));
+    }
+
+    if (!limited) {
+      RemoveLeaf(leaf_path);
+      return false;
+    }
+    return true;
+  }
+
+  // Removes the leaf, or retries later while exiting processes still
+  // populate it
+  void RemoveLeaf(const std::string& leaf_path) {
+    if (rmdir(leaf_path.c_str()) == 0 || errno == ENOENT) {
+      return;
+    }
+    std::lock_guard<std::mutex> l(mtx_);
+    stale_leaves_.push_back(leaf_path);
+  }
+
+ private:
+  bool EnableControllers() {
+    if (access((root_path_ + "/cgroup.controllers").c_str(), F_OK) != 0) {
+      LOG_ERROR << root_path_ << " is not a cgroup v2 directory";
+      return false;
+    }
+    for (const char* controller : {"+cpu", "+memory", "+pids"}) {
+      if (!WriteCgroupFile(root_path_ + "/cgroup.subtree_control", controller)) {
+        LOG_ERROR << "Failed to enable " << controller + 1 << " controller in "
+                  << root_path_ << ": " << strerror(errno);
+        return false;
+      }
+    }
+    controllers_enabled_ = true;
+    return true;
+  }
+
+  bool WriteLimit(const std::string& leaf_path, const char* file, const std::string& value) {
+    if (!WriteCgroupFile(leaf_path + "/" + file, value)) {
+      LOG_ERROR << "Failed to write " << value << " to " << leaf_path << "/" << file << ": "
+                << strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+  // Called with `mtx_` held
+  void RemoveStaleLeaves() {
+    std::vector<std::string> still_populated;
+    for (const auto& leaf_path : stale_leaves_) {
+      if (rmdir(leaf_path.c_str()) != 0 && errno == EBUSY) {
+        still_populated.push_back(leaf_path);
+      }
+    }
+    stale_leaves_ = std::move(still_populated);
+  }
+
+  std::string root_path_;
+  std::atomic<uint64_t> next_leaf_id_{0};
+
+  std::mutex mtx_;
+  bool controllers_enabled_ = false;
+  std::vector<std::string> stale_leaves_;
+};
+
+} // namespace cgroup
+#endif
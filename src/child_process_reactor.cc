@@ -0,0 +1,326 @@
+#include "child_process_reactor.h"
+
+#if !defined(_WIN32)
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#else
+#include <poll.h>
+#endif
+
+#include "trantor/utils/Logger.h"
+
+namespace {
+
+constexpr const int kMaxEventsPerWait = 64;
+
+// Write end of the wake pipe of the reactor relying on SIGCHLD
+std::atomic<int> g_sigchld_wake_fd{-1};
+struct sigaction g_previous_sigchld_action;
+
+void OnSigchld(int signum, siginfo_t* info, void* context) {
+  int saved_errno = errno;
+  int fd = g_sigchld_wake_fd.load();
+  if (fd >= 0) {
+    char c = 1;
+    (void)!write(fd, &c, 1);
+  }
+  // Keep whatever handler the host process installed working
+  if (g_previous_sigchld_action.sa_flags & SA_SIGINFO) {
+    if (g_previous_sigchld_action.sa_sigaction) {
+      g_previous_sigchld_action.sa_sigaction(signum, info, context);
+    }
+  } else if (g_previous_sigchld_action.sa_handler != SIG_DFL &&
+             g_previous_sigchld_action.sa_handler != SIG_IGN) {
+    g_previous_sigchld_action.sa_handler(signum);
+  }
+  errno = saved_errno;
+}
+
+#if defined(__linux__)
+int PidfdOpen(pid_t pid) {
+#if defined(SYS_pidfd_open)
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+#endif
+
+} // namespace
+
+ChildProcessReactor::ChildProcessReactor() {
+  if (pipe(wake_fds_) != 0) {
+    LOG_ERROR << "Failed to create reactor wake pipe: " << strerror(errno);
+  }
+  for (int fd : wake_fds_) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+#if defined(__linux__)
+  poll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_fds_[0];
+  epoll_ctl(poll_fd_, EPOLL_CTL_ADD, wake_fds_[0], &event);
+
+  // pidfds need Linux 5.3, probe with our own pid
+  int pidfd = PidfdOpen(getpid());
+  if (pidfd >= 0) {
+    close(pidfd);
+    use_pidfd_ = true;
+  }
+#endif
+
+  if (!use_pidfd_) {
+    LOG_INFO << "Watching child processes through SIGCHLD";
+    InstallSigchldHandler();
+  }
+
+  thread_ = std::thread([this] { Run(); });
+}
+
+ChildProcessReactor::~ChildProcessReactor() {
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    running_ = false;
+  }
+  Wake();
+  thread_.join();
+
+  if (!use_pidfd_) {
+    sigaction(SIGCHLD, &g_previous_sigchld_action, nullptr);
+    g_sigchld_wake_fd = -1;
+  }
+  if (poll_fd_ >= 0) {
+    close(poll_fd_);
+  }
+  close(wake_fds_[0]);
+  close(wake_fds_[1]);
+}
+
+void ChildProcessReactor::WatchChild(pid_t pid, ExitHandler on_exit) {
+#if defined(__linux__)
+  if (use_pidfd_) {
+    int pidfd = PidfdOpen(pid);
+    if (pidfd >= 0) {
+      WatchFd(pidfd, [this, pid, pidfd, on_exit = std::move(on_exit)] {
+        int status = 0;
+        pid_t reaped = waitpid(pid, &status, WNOHANG);
+        if (reaped == 0) {
+          return;
+        }
+        if (reaped < 0) {
+          LOG_WARN << "Child process " << pid << " was reaped elsewhere";
+        }
+        UnwatchFd(pidfd);
+        close(pidfd);
+        on_exit(status);
+      });
+      return;
+    }
+    LOG_WARN << "pidfd_open failed for " << pid << ": " << strerror(errno);
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    child_handlers_[pid] = std::move(on_exit);
+  }
+  // The child may have exited before it was registered
+  Wake();
+}
+
+void ChildProcessReactor::WatchFd(int fd, ReadableHandler on_readable) {
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    fd_handlers_[fd] = std::make_shared<ReadableHandler>(std::move(on_readable));
+  }
+#if defined(__linux__)
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLRDHUP;
+  event.data.fd = fd;
+  if (epoll_ctl(poll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+    LOG_ERROR << "Failed to watch fd " << fd << ": " << strerror(errno);
+  }
+#else
+  Wake();
+#endif
+}
+
+void ChildProcessReactor::UnwatchFd(int fd) {
+#if defined(__linux__)
+  epoll_ctl(poll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+  std::lock_guard<std::mutex> l(mtx_);
+  fd_handlers_.erase(fd);
+}
+
+void ChildProcessReactor::Wake() {
+  char c = 1;
+  (void)!write(wake_fds_[1], &c, 1);
+}
+
+void ChildProcessReactor::Run() {
+  while (true) {
+    std::vector<int> ready_fds;
+#if defined(__linux__)
+    struct epoll_event events[kMaxEventsPerWait];
+    int n = epoll_wait(poll_fd_, events, kMaxEventsPerWait, NextTimerTimeoutMs());
+    for (int i = 0; i < n; i++) {
+      ready_fds.push_back(events[i].data.fd);
+    }
+#else
+    std::vector<struct pollfd> poll_fds;
+    poll_fds.push_back({wake_fds_[0], POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      for (const auto& [fd, handler] : fd_handlers_) {
+        poll_fds.push_back({fd, POLLIN, 0});
+      }
+    }
+    int n = poll(poll_fds.data(), poll_fds.size(), NextTimerTimeoutMs());
+    for (int i = 0; n > 0 && i < static_cast<int>(poll_fds.size()); i++) {
+      if (poll_fds[i].revents) {
+        ready_fds.push_back(poll_fds[i].fd);
+      }
+    }
+#endif
+    if (n < 0 && errno != EINTR) {
+      LOG_ERROR << "Reactor wait failed: " << strerror(errno);
+    }
+
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      if (!running_) {
+        return;
+      }
+    }
+
+    bool woken = false;
+    for (int fd : ready_fds) {
+      if (fd == wake_fds_[0]) {
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0) {
+        }
+        woken = true;
+        continue;
+      }
+
+      std::shared_ptr<ReadableHandler> handler;
+      {
+        std::lock_guard<std::mutex> l(mtx_);
+        auto it = fd_handlers_.find(fd);
+        if (it != fd_handlers_.end()) {
+          handler = it->second;
+        }
+      }
+      if (handler) {
+        (*handler)();
+      }
+    }
+
+    if (woken && !use_pidfd_) {
+      ReapExitedChildren();
+    }
+    RunDueTimers();
+  }
+}
+
+ChildProcessReactor::TimerId ChildProcessReactor::RunAt(
+    std::chrono::steady_clock::time_point deadline, TimerHandler on_timer) {
+  TimerId id;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    id = next_timer_id_++;
+    timer_queue_.emplace(deadline, id);
+    timers_[id] = std::move(on_timer);
+  }
+  // The loop may be waiting for a later deadline
+  Wake();
+  return id;
+}
+
+void ChildProcessReactor::CancelTimer(TimerId id) {
+  std::lock_guard<std::mutex> l(mtx_);
+  timers_.erase(id);
+}
+
+int ChildProcessReactor::NextTimerTimeoutMs() {
+  std::lock_guard<std::mutex> l(mtx_);
+  while (!timer_queue_.empty() && !timers_.count(timer_queue_.begin()->second)) {
+    timer_queue_.erase(timer_queue_.begin());
+  }
+  if (timer_queue_.empty()) {
+    return -1;
+  }
+  auto remaining = timer_queue_.begin()->first - std::chrono::steady_clock::now();
+  // Rounded up, so the loop does not wake up right before the deadline
+  auto remaining_ms = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+  return static_cast<int>(std::max<decltype(remaining_ms)>(0, remaining_ms));
+}
+
+void ChildProcessReactor::RunDueTimers() {
+  std::vector<TimerHandler> due;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    auto now = std::chrono::steady_clock::now();
+    while (!timer_queue_.empty() && timer_queue_.begin()->first <= now) {
+      auto it = timers_.find(timer_queue_.begin()->second);
+      if (it != timers_.end()) {
+        due.push_back(std::move(it->second));
+        timers_.erase(it);
+      }
+      timer_queue_.erase(timer_queue_.begin());
+    }
+  }
+  for (auto& on_timer : due) {
+    on_timer();
+  }
+}
+
+void ChildProcessReactor::ReapExitedChildren() {
+  std::vector<std::pair<ExitHandler, int>> exited;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    for (auto it = child_handlers_.begin(); it != child_handlers_.end();) {
+      int status = 0;
+      pid_t reaped = waitpid(it->first, &status, WNOHANG);
+      if (reaped == 0) {
+        ++it;
+        continue;
+      }
+      if (reaped < 0) {
+        LOG_WARN << "Child process " << it->first << " was reaped elsewhere";
+      }
+      exited.emplace_back(std::move(it->second), status);
+      it = child_handlers_.erase(it);
+    }
+  }
+  for (auto& [on_exit, status] : exited) {
+    on_exit(status);
+  }
+}
+
+void ChildProcessReactor::InstallSigchldHandler() {
+  g_sigchld_wake_fd = wake_fds_[1];
+
+  struct sigaction action = {};
+  action.sa_sigaction = OnSigchld;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &action, &g_previous_sigchld_action);
+}
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+
+// Single event loop thread which watches every child process of the engine
+// and the channels of its workers, instead of one blocked thread per child.
+// It also runs the timers bounding how long executions may take.
+// On Linux children are watched through pidfd_open + epoll; where pidfds are
+// not available, exits are picked up through a SIGCHLD self-pipe.
+//
+// Handlers run on the reactor thread and must not block.
+class ChildProcessReactor {
+ public:
+  // Receives the wait status of the reaped child
+  using ExitHandler = std::function<void(int)>;
+  using ReadableHandler = std::function<void()>;
+  using TimerHandler = std::function<void()>;
+  using TimerId = uint64_t;
+
+  ChildProcessReactor();
+  ~ChildProcessReactor();
+
+  // Calls `on_exit` once `pid`, a child of this process, exited. The reactor
+  // reaps the child, nobody else may wait for it.
+  void WatchChild(pid_t pid, ExitHandler on_exit);
+
+  // Calls `on_readable` whenever `fd` is readable or hung up, until
+  // UnwatchFd. Handlers may be woken up spuriously and must not block on
+  // reads.
+  void WatchFd(int fd, ReadableHandler on_readable);
+  void UnwatchFd(int fd);
+
+  // Calls `on_timer` once `deadline` passed, unless cancelled before
+  TimerId RunAt(std::chrono::steady_clock::time_point deadline, TimerHandler on_timer);
+  void CancelTimer(TimerId id);
+
+ private:
+  void Run();
+  void Wake();
+  void ReapExitedChildren();
+  void InstallSigchldHandler();
+  // Milliseconds until the next timer is due, -1 without timers
+  int NextTimerTimeoutMs();
+  void RunDueTimers();
+
+  std::mutex mtx_;
+  std::unordered_map<int, std::shared_ptr<ReadableHandler>> fd_handlers_;
+  // Children waited through the SIGCHLD fallback
+  std::unordered_map<pid_t, ExitHandler> child_handlers_;
+  // Deadlines in order, cancelled timers are skipped once due
+  std::multimap<std::chrono::steady_clock::time_point, TimerId> timer_queue_;
+  std::unordered_map<TimerId, TimerHandler> timers_;
+  TimerId next_timer_id_ = 0;
+
+  bool use_pidfd_ = false;
+  int poll_fd_ = -1;
+  int wake_fds_[2] = {-1, -1};
+  bool running_ = true;
+  std::thread thread_;
+};
+#endif
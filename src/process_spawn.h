@@ -0,0 +1,197 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+extern char **environ;
+
+namespace process_spawn {
+
+// How child processes are created. Every strategy execs the target binary;
+// executions which skip exec altogether go through the fork server instead.
+enum class SpawnStrategy {
+  // posix_spawn with the default behavior of the C library
+  kPosixSpawn,
+  // posix_spawn asked to vfork, only meaningful with older glibc
+  kPosixSpawnVfork,
+  // clone(CLONE_VM | CLONE_VFORK) then execve, Linux only
+  kCloneVfork,
+};
+
+constexpr const char* kSpawnStrategyPosixSpawn = "posix_spawn";
+constexpr const char* kSpawnStrategyPosixSpawnVfork = "posix_spawn_vfork";
+constexpr const char* kSpawnStrategyCloneVfork = "clone_vfork";
+
+inline bool ParseSpawnStrategy(const std::string& name, SpawnStrategy& strategy) {
+  if (name == kSpawnStrategyPosixSpawn) {
+    strategy = SpawnStrategy::kPosixSpawn;
+  } else if (name == kSpawnStrategyPosixSpawnVfork) {
+    strategy = SpawnStrategy::kPosixSpawnVfork;
+  } else if (name == kSpawnStrategyCloneVfork) {
+    strategy = SpawnStrategy::kCloneVfork;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Descriptor `first` of the parent becomes descriptor `second` of the child
+using FdMapping = std::pair<int, int>;
+
+inline int PosixSpawn(bool use_vfork,
+                      const std::string& exe_path,
+                      const std::vector<char*>& argv,
+                      const std::vector<FdMapping>& fd_mappings,
+                      pid_t& pid) {
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  for (const auto& [from, to] : fd_mappings) {
+    posix_spawn_file_actions_adddup2(&file_actions, from, to);
+  }
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  short flags = POSIX_SPAWN_SETPGROUP;
+#if defined(POSIX_SPAWN_USEVFORK)
+  if (use_vfork) {
+    flags |= POSIX_SPAWN_USEVFORK;
+  }
+#endif
+  posix_spawnattr_setflags(&attr, flags);
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  int status = posix_spawn(&pid, exe_path.c_str(), &file_actions, &attr,
+                           argv.data(), environ);
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&file_actions);
+  return status;
+}
+
+#if defined(__linux__)
+struct CloneVforkArgs {
+  const char* exe_path;
+  char* const* argv;
+  const std::vector<FdMapping>* fd_mappings;
+  const sigset_t* parent_mask;
+  // Written by the child, which shares our memory, when exec fails
+  int exec_errno;
+};
+
+// Runs in the child on a separate stack while the parent is suspended. Only
+// async-signal-safe calls are allowed here.
+inline int CloneVforkChild(void* arg) {
+  auto* args = static_cast<CloneVforkArgs*>(arg);
+
+  // Handlers of the parent must not run in a child sharing its memory
+  for (int signum = 1; signum < NSIG; signum++) {
+    struct sigaction action;
+    if (sigaction(signum, nullptr, &action) == 0 && action.sa_handler != SIG_IGN &&
+        action.sa_handler != SIG_DFL) {
+      action.sa_handler = SIG_DFL;
+      sigaction(signum, &action, nullptr);
+    }
+  }
+  sigprocmask(SIG_SETMASK, args->parent_mask, nullptr);
+  setpgid(0, 0);
+
+  for (const auto& [from, to] : *args->fd_mappings) {
+    if (from == to) {
+      int flags = fcntl(from, F_GETFD);
+      fcntl(from, F_SETFD, flags & ~FD_CLOEXEC);
+    } else if (dup2(from, to) < 0) {
+      args->exec_errno = errno;
+      _exit(127);
+    }
+  }
+
+  execve(args->exe_path, args->argv, environ);
+  args->exec_errno = errno;
+  _exit(127);
+}
+
+inline int CloneVfork(const std::string& exe_path,
+                      const std::vector<char*>& argv,
+                      const std::vector<FdMapping>& fd_mappings,
+                      pid_t& pid) {
+  constexpr size_t kChildStackSize = 64 * 1024;
+  void* stack = mmap(nullptr, kChildStackSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED) {
+    return errno;
+  }
+
+  // No signal may be handled in the child before its handlers are reset
+  sigset_t all_signals;
+  sigset_t parent_mask;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &parent_mask);
+
+  CloneVforkArgs args = {exe_path.c_str(), argv.data(), &fd_mappings, &parent_mask, 0};
+  // The parent resumes once the child exec'd or exited
+  pid = clone(CloneVforkChild, static_cast<char*>(stack) + kChildStackSize,
+              CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int clone_errno = errno;
+
+  pthread_sigmask(SIG_SETMASK, &parent_mask, nullptr);
+  munmap(stack, kChildStackSize);
+
+  if (pid < 0) {
+    return clone_errno;
+  }
+  if (args.exec_errno != 0) {
+    waitpid(pid, nullptr, 0);
+    return args.exec_errno;
+  }
+  return 0;
+}
+#endif
+
+// Starts `exe_path` with `args` (argv[0] excluded) and the descriptors of
+// `fd_mappings`. The child leads a new process group, so it can be signalled
+// along with its own children. Returns 0 on success, an errno value
+// otherwise.
+inline int SpawnProcess(SpawnStrategy strategy,
+                        const std::string& exe_path,
+                        const std::vector<std::string>& args,
+                        const std::vector<FdMapping>& fd_mappings,
+                        pid_t& pid) {
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(exe_path.c_str()));
+  for (const auto& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  switch (strategy) {
+    case SpawnStrategy::kCloneVfork:
+#if defined(__linux__)
+      return CloneVfork(exe_path, argv, fd_mappings, pid);
+#else
+      // Not available here, behave like posix_spawn
+      return PosixSpawn(false, exe_path, argv, fd_mappings, pid);
+#endif
+    case SpawnStrategy::kPosixSpawnVfork:
+      return PosixSpawn(true, exe_path, argv, fd_mappings, pid);
+    case SpawnStrategy::kPosixSpawn:
+    default:
+      return PosixSpawn(false, exe_path, argv, fd_mappings, pid);
+  }
+}
+
+} // namespace process_spawn
+
+#endif
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace PythonRuntime::Admission {
+
+enum class AdmissionResult {
+  kStarted,
+  kQueued,
+  // The queue is full, the execution was dropped
+  kRejected,
+};
+
+// Queued executions of a higher class always start first
+enum class PriorityClass {
+  kInteractive = 0,
+  kNormal = 1,
+  kBatch = 2,
+};
+
+constexpr const char* kPriorityInteractive = "interactive";
+constexpr const char* kPriorityNormal = "normal";
+constexpr const char* kPriorityBatch = "batch";
+constexpr const size_t kPriorityClassCount = 3;
+
+inline bool ParsePriorityClass(const std::string& name, PriorityClass& priority) {
+  if (name == "" || name == kPriorityNormal) {
+    priority = PriorityClass::kNormal;
+  } else if (name == kPriorityInteractive) {
+    priority = PriorityClass::kInteractive;
+  } else if (name == kPriorityBatch) {
+    priority = PriorityClass::kBatch;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Bounds the number of executions running at once. Executions beyond
+// `max_running` wait, at most `max_queued` of them, and are handed out for
+// starting once slots free up. A limit of 0 disables it.
+//
+// Waiting executions are started by strict priority between classes. Within
+// a class, tenants share the slots in proportion to their weight through
+// start-time fair queuing, each execution costing the same. A tenant
+// without a weight has a weight of 1.
+class AdmissionQueue {
+ public:
+  using StartFunc = std::function<void()>;
+
+  AdmissionQueue(size_t max_running, size_t max_queued)
+      : max_running_(max_running), max_queued_(max_queued) {}
+
+  // Runs `start` right away when a slot is free, the caller must call Finish
+  // once the execution it started is done
+  AdmissionResult Submit(StartFunc start,
+                         PriorityClass priority = PriorityClass::kNormal,
+                         const std::string& tenant = "") {
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      if (HasFreeSlot()) {
+        running_++;
+      } else if (queued_count_ < max_queued_) {
+        Enqueue(std::move(start), priority, tenant);
+        return AdmissionResult::kQueued;
+      } else {
+        return AdmissionResult::kRejected;
+      }
+    }
+    start();
+    return AdmissionResult::kStarted;
+  }
+
+  // Frees the slot of an execution which ran for `duration`. Returns the
+  // queued executions which got a slot, for the caller to start without
+  // holding its own locks.
+  [[nodiscard]] std::vector<StartFunc> Finish(std::chrono::steady_clock::duration duration) {
+    std::lock_guard<std::mutex> l(mtx_);
+    running_--;
+    double seconds = std::chrono::duration<double>(duration).count();
+    average_seconds_ = average_seconds_ == 0 ? seconds
+                                             : kAverageWeight * seconds +
+                                                   (1 - kAverageWeight) * average_seconds_;
+    return TakeStartable();
+  }
+
+  // Returns the queued executions which got a slot, like Finish
+  [[nodiscard]] std::vector<StartFunc> SetLimits(size_t max_running, size_t max_queued) {
+    std::lock_guard<std::mutex> l(mtx_);
+    max_running_ = max_running;
+    max_queued_ = max_queued;
+    return TakeStartable();
+  }
+
+  // Weights apply to executions queued from now on
+  void SetTenantWeights(std::map<std::string, double> tenant_weights) {
+    std::lock_guard<std::mutex> l(mtx_);
+    tenant_weights_ = std::move(tenant_weights);
+  }
+
+  // Seconds until a rejected execution would likely be admitted, from the
+  // recent execution durations
+  int RetryAfterSeconds() {
+    std::lock_guard<std::mutex> l(mtx_);
+    size_t slots = std::max<size_t>(1, max_running_);
+    double seconds = average_seconds_ * (queued_count_ + slots) / slots;
+    return std::max(1, static_cast<int>(std::ceil(seconds)));
+  }
+
+ private:
+  // Weight of the latest duration in the moving average
+  static constexpr double kAverageWeight = 0.2;
+
+  struct QueuedExecution {
+    double start_tag;
+    double finish_tag;
+    StartFunc start;
+  };
+
+  struct TenantQueue {
+    std::deque<QueuedExecution> executions;
+    // Finish tag of the last execution queued by the tenant
+    double last_finish_tag = 0;
+  };
+
+  struct ClassQueue {
+    std::unordered_map<std::string, TenantQueue> tenants;
+    // Start tag of the execution started last
+    double virtual_time = 0;
+  };
+
+  bool HasFreeSlot() const { return max_running_ == 0 || running_ < max_running_; }
+
+  // Called with `mtx_` held
+  void Enqueue(StartFunc start, PriorityClass priority, const std::string& tenant) {
+    auto weight_it = tenant_weights_.find(tenant);
+    double weight = weight_it != tenant_weights_.end() ? weight_it->second : 1;
+
+    auto& class_queue = classes_[static_cast<size_t>(priority)];
+    auto& tenant_queue = class_queue.tenants[tenant];
+    // A tenant which was idle gets no credit for it
+    double start_tag = tenant_queue.executions.empty()
+                           ? class_queue.virtual_time
+                           : std::max(class_queue.virtual_time, tenant_queue.last_finish_tag);
+    tenant_queue.last_finish_tag = start_tag + 1 / weight;
+    tenant_queue.executions.push_back({start_tag, tenant_queue.last_finish_tag, std::move(start)});
+    queued_count_++;
+  }
+
+  // Called with `mtx_` held, removes the next execution to start
+  StartFunc Dequeue() {
+    for (auto& class_queue : classes_) {
+      auto next = class_queue.tenants.end();
+      for (auto it = class_queue.tenants.begin(); it != class_queue.tenants.end(); ++it) {
+        if (next == class_queue.tenants.end() ||
+            it->second.executions.front().finish_tag < next->second.executions.front().finish_tag) {
+          next = it;
+        }
+      }
+      if (next == class_queue.tenants.end()) {
+        continue;
+      }
+
+      auto execution = std::move(next->second.executions.front());
+      next->second.executions.pop_front();
+      if (next->second.executions.empty()) {
+        class_queue.tenants.erase(next);
+      }
+      class_queue.virtual_time = execution.start_tag;
+      queued_count_--;
+      return std::move(execution.start);
+    }
+    return nullptr;
+  }
+
+  // Called with `mtx_` held
+  std::vector<StartFunc> TakeStartable() {
+    std::vector<StartFunc> startable;
+    while (queued_count_ > 0 && HasFreeSlot()) {
+      running_++;
+      startable.push_back(Dequeue());
+    }
+    return startable;
+  }
+
+  std::mutex mtx_;
+  size_t max_running_;
+  size_t max_queued_;
+  size_t running_ = 0;
+  std::array<ClassQueue, kPriorityClassCount> classes_;
+  size_t queued_count_ = 0;
+  std::map<std::string, double> tenant_weights_;
+  double average_seconds_ = 0;
+};
+
+// Starts admitted executions in order on its own thread. Starting may block,
+// e.g. on the zygote forking a child or on spawning workers, which the
+// reactor thread finishing executions must not.
+class StartDispatcher {
+ public:
+  using StartFunc = AdmissionQueue::StartFunc;
+
+  StartDispatcher() = default;
+  StartDispatcher(const StartDispatcher&) = delete;
+  StartDispatcher& operator=(const StartDispatcher&) = delete;
+
+  // Runs what is still pending first
+  ~StartDispatcher() {
+    {
+      std::lock_guard<std::mutex> l(mtx_);
+      stopping_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  void Dispatch(std::vector<StartFunc>&& starts) {
+    if (starts.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> l(mtx_);
+    for (auto& start : starts) {
+      pending_.push_back(std::move(start));
+    }
+    // Started on first use, most engines never queue an execution
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { Run(); });
+    }
+    cond_.notify_one();
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> l(mtx_);
+    while (true) {
+      cond_.wait(l, [this] { return stopping_ || !pending_.empty(); });
+      if (pending_.empty()) {
+        return;
+      }
+      auto start = std::move(pending_.front());
+      pending_.pop_front();
+      l.unlock();
+      start();
+      l.lock();
+    }
+  }
+
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  std::deque<StartFunc> pending_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+} // namespace PythonRuntime::Admission
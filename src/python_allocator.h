@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+
+#if defined(CORTEX_PYTHON_MIMALLOC)
+#include <mimalloc.h>
+#endif
+
+namespace python_utils {
+
+// Allocator names of startup profiles. pymalloc is the allocator Python
+// starts with, malloc and mimalloc replace it in every memory domain.
+constexpr const char* kAllocatorPymalloc = "pymalloc";
+constexpr const char* kAllocatorMalloc = "malloc";
+constexpr const char* kAllocatorMimalloc = "mimalloc";
+
+// Same layout as PyMemAllocatorEx and PyMemAllocatorDomain
+struct PyMemAllocatorEx {
+  void* ctx;
+  void* (*malloc)(void* ctx, size_t size);
+  void* (*calloc)(void* ctx, size_t nelem, size_t elsize);
+  void* (*realloc)(void* ctx, void* ptr, size_t new_size);
+  void (*free)(void* ctx, void* ptr);
+};
+constexpr const int kPyMemDomainRaw = 0;
+constexpr const int kPyMemDomainMem = 1;
+constexpr const int kPyMemDomainObj = 2;
+
+inline bool IsKnownAllocator(const std::string& name) {
+  return name == "" || name == kAllocatorPymalloc || name == kAllocatorMalloc || name == kAllocatorMimalloc;
+}
+
+// Whether this binary can install `name`
+inline bool IsAllocatorAvailable(const std::string& name) {
+#if defined(CORTEX_PYTHON_MIMALLOC)
+  return IsKnownAllocator(name);
+#else
+  return IsKnownAllocator(name) && name != kAllocatorMimalloc;
+#endif
+}
+
+// Python asks for 0 bytes at times, which must not return null
+inline PyMemAllocatorEx MallocAllocator() {
+  return {nullptr,
+          [](void*, size_t size) { return std::malloc(size ? size : 1); },
+          [](void*, size_t nelem, size_t elsize) {
+            return nelem && elsize ? std::calloc(nelem, elsize) : std::calloc(1, 1);
+          },
+          [](void*, void* ptr, size_t new_size) { return std::realloc(ptr, new_size ? new_size : 1); },
+          [](void*, void* ptr) { std::free(ptr); }};
+}
+
+#if defined(CORTEX_PYTHON_MIMALLOC)
+inline PyMemAllocatorEx MimallocAllocator() {
+  return {nullptr,
+          [](void*, size_t size) { return mi_malloc(size ? size : 1); },
+          [](void*, size_t nelem, size_t elsize) {
+            return nelem && elsize ? mi_calloc(nelem, elsize) : mi_calloc(1, 1);
+          },
+          [](void*, void* ptr, size_t new_size) { return mi_realloc(ptr, new_size ? new_size : 1); },
+          [](void*, void* ptr) { mi_free(ptr); }};
+}
+#endif
+
+// Allocator replacing pymalloc for `name`, false to keep the one Python
+// starts with
+inline bool GetReplacementAllocator(const std::string& name, PyMemAllocatorEx& allocator) {
+  if (name == kAllocatorMalloc) {
+    allocator = MallocAllocator();
+    return true;
+  }
+#if defined(CORTEX_PYTHON_MIMALLOC)
+  if (name == kAllocatorMimalloc) {
+    allocator = MimallocAllocator();
+    return true;
+  }
+#endif
+  return false;
+}
+
+} // namespace python_utils
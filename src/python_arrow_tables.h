@@ -0,0 +1,377 @@
+#pragma once
+
+#if !defined(_WIN32)
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/cortex-common/cortex_arrow.h"
+#include "json/value.h"
+
+namespace python_utils {
+
+// Columns shared with scripts are flat: booleans, fixed width numbers, and
+// UTF-8 strings or binaries with 32 or 64 bit offsets. Buffers of a column in
+// the shared regions come in the Arrow order: validity (null when the column
+// has no nulls), offsets for variable length formats, then values. Columns
+// never have an offset there, their buffers start at their first value.
+
+// Bytes per value of fixed width formats, 0 for the others
+inline int ArrowValueWidth(const std::string& format) {
+  if (format == "c" || format == "C") return 1;
+  if (format == "s" || format == "S" || format == "e") return 2;
+  if (format == "i" || format == "I" || format == "f") return 4;
+  if (format == "l" || format == "L" || format == "g") return 8;
+  return 0;
+}
+
+// Bytes per offset of variable length formats, 0 for the others
+inline int ArrowOffsetWidth(const std::string& format) {
+  if (format == "u" || format == "z") return 4;
+  if (format == "U" || format == "Z") return 8;
+  return 0;
+}
+
+inline bool IsSharedArrowFormat(const std::string& format) {
+  return format == "b" || ArrowValueWidth(format) != 0 || ArrowOffsetWidth(format) != 0;
+}
+
+inline int64_t ArrowBitmapSize(int64_t length) { return (length + 7) / 8; }
+
+inline bool ArrowBit(const void* bitmap, int64_t i) {
+  return (static_cast<const uint8_t*>(bitmap)[i / 8] >> (i % 8)) & 1;
+}
+
+inline int64_t ArrowOffset(const void* offsets, int width, int64_t i) {
+  if (width == 4) {
+    int32_t offset;
+    memcpy(&offset, static_cast<const char*>(offsets) + i * 4, 4);
+    return offset;
+  }
+  int64_t offset;
+  memcpy(&offset, static_cast<const char*>(offsets) + i * 8, 8);
+  return offset;
+}
+
+// Bits [start, start + length) of `src` to the start of `dst`
+inline void CopyArrowBits(const void* src, int64_t start, int64_t length, void* dst) {
+  if (start % 8 == 0) {
+    memcpy(dst, static_cast<const uint8_t*>(src) + start / 8, ArrowBitmapSize(length));
+    return;
+  }
+  auto bytes = static_cast<uint8_t*>(dst);
+  memset(bytes, 0, ArrowBitmapSize(length));
+  for (int64_t i = 0; i < length; i++) {
+    if (ArrowBit(src, start + i)) {
+      bytes[i / 8] |= 1 << (i % 8);
+    }
+  }
+}
+
+// Returns why the record batch `table` cannot be shared with a script, or an
+// empty string
+inline std::string ValidateArrowTable(const CortexArrowTable& table) {
+  const ArrowSchema& schema = table.schema;
+  const ArrowArray& array = table.array;
+  std::string prefix = "Table " + table.name;
+  if (!schema.release || !array.release) {
+    return prefix + " is released";
+  }
+  if (!schema.format || std::string(schema.format) != "+s" || schema.n_children != array.n_children) {
+    return prefix + " must be a struct array";
+  }
+  if (array.length < 0 || array.offset < 0) {
+    return prefix + " has a negative length or offset";
+  }
+  if (array.n_buffers > 0 && array.buffers[0] && array.null_count != 0) {
+    return prefix + " must not have null rows";
+  }
+  std::set<std::string> names;
+  for (int64_t i = 0; i < schema.n_children; i++) {
+    const ArrowSchema& child_schema = *schema.children[i];
+    const ArrowArray& child = *array.children[i];
+    std::string name = child_schema.name ? child_schema.name : "";
+    std::string format = child_schema.format ? child_schema.format : "";
+    std::string column = prefix + " column " + name;
+    if (!names.insert(name).second) {
+      return column + " is not unique";
+    }
+    if (!IsSharedArrowFormat(format) || child_schema.n_children != 0 || child_schema.dictionary) {
+      return column + " has the unsupported format " + format;
+    }
+    if (child.n_buffers != (ArrowOffsetWidth(format) ? 3 : 2) || child.offset < 0 ||
+        child.length < array.offset + array.length) {
+      return column + " does not match its format or table";
+    }
+    if (array.length > 0 && (!child.buffers[child.n_buffers - 1] ||
+                             (ArrowOffsetWidth(format) && !child.buffers[1]))) {
+      return column + " misses a buffer";
+    }
+    if (!child.buffers[0] && child.null_count > 0) {
+      return column + " has nulls without a validity bitmap";
+    }
+  }
+  return "";
+}
+
+// Lays out the columns of `table` from `size` on, advancing it, and returns
+// their entries in the table of the region: {"length", "columns": [{"name",
+// "format", "null_count", "buffers": [[offset, length] or null]}]}
+inline Json::Value PlanArrowTable(const CortexArrowTable& table, size_t alignment, size_t& size) {
+  const ArrowArray& array = table.array;
+  auto allocate = [&](int64_t length) {
+    size = (size + alignment - 1) / alignment * alignment;
+    Json::Value buffer(Json::arrayValue);
+    buffer.append(Json::UInt64(size));
+    buffer.append(Json::UInt64(length));
+    size += length;
+    return buffer;
+  };
+
+  Json::Value entry;
+  entry["length"] = Json::Int64(array.length);
+  entry["columns"] = Json::Value(Json::arrayValue);
+  for (int64_t i = 0; i < array.n_children; i++) {
+    const ArrowArray& child = *array.children[i];
+    std::string format = table.schema.children[i]->format;
+    int64_t start = array.offset + child.offset;
+    int64_t null_count = 0;
+    if (child.buffers[0] && array.length > 0) {
+      null_count = child.null_count;
+      if (null_count < 0) {
+        null_count = 0;
+        for (int64_t j = 0; j < array.length; j++) {
+          null_count += !ArrowBit(child.buffers[0], start + j);
+        }
+      }
+    }
+
+    Json::Value column;
+    column["name"] = table.schema.children[i]->name ? table.schema.children[i]->name : "";
+    column["format"] = format;
+    column["null_count"] = Json::Int64(null_count);
+    column["buffers"].append(null_count > 0 ? allocate(ArrowBitmapSize(array.length)) : Json::Value());
+    if (int width = ArrowOffsetWidth(format)) {
+      column["buffers"].append(allocate((array.length + 1) * width));
+      int64_t length = array.length > 0 ? ArrowOffset(child.buffers[1], width, start + array.length) -
+                                              ArrowOffset(child.buffers[1], width, start)
+                                        : 0;
+      column["buffers"].append(allocate(length));
+    } else if (format == "b") {
+      column["buffers"].append(allocate(ArrowBitmapSize(array.length)));
+    } else {
+      column["buffers"].append(allocate(array.length * ArrowValueWidth(format)));
+    }
+    entry["columns"].append(std::move(column));
+  }
+  return entry;
+}
+
+// Copies the columns of `table` into `region` where `entry` of
+// PlanArrowTable placed them
+inline void CopyArrowTable(const CortexArrowTable& table, const Json::Value& entry, char* region) {
+  const ArrowArray& array = table.array;
+  int64_t length = array.length;
+  for (int64_t i = 0; i < array.n_children; i++) {
+    const ArrowArray& child = *array.children[i];
+    const Json::Value& buffers = entry["columns"][Json::ArrayIndex(i)]["buffers"];
+    std::string format = table.schema.children[i]->format;
+    int64_t start = array.offset + child.offset;
+    auto out = [&](int b) { return region + buffers[b][0].asUInt64(); };
+    if (!buffers[0].isNull()) {
+      CopyArrowBits(child.buffers[0], start, length, out(0));
+    }
+    if (int width = ArrowOffsetWidth(format)) {
+      // Rebased on the first value, which is all that is copied
+      int64_t first = length > 0 ? ArrowOffset(child.buffers[1], width, start) : 0;
+      for (int64_t j = 0; j <= length; j++) {
+        int64_t offset = length > 0 ? ArrowOffset(child.buffers[1], width, start + j) - first : 0;
+        if (width == 4) {
+          int32_t narrow = static_cast<int32_t>(offset);
+          memcpy(out(1) + j * 4, &narrow, 4);
+        } else {
+          memcpy(out(1) + j * 8, &offset, 8);
+        }
+      }
+      if (buffers[2][1].asUInt64() > 0) {
+        memcpy(out(2), static_cast<const char*>(child.buffers[2]) + first, buffers[2][1].asUInt64());
+      }
+    } else if (format == "b") {
+      if (length > 0) {
+        CopyArrowBits(child.buffers[1], start, length, out(1));
+      }
+    } else if (length > 0) {
+      int width = ArrowValueWidth(format);
+      memcpy(out(1), static_cast<const char*>(child.buffers[1]) + start * width, length * width);
+    }
+  }
+}
+
+// Releasable structs of tables whose buffers point into a shared region
+struct ExportedArrowSchema {
+  std::string format;
+  std::string name;
+  std::vector<ArrowSchema> children;
+  std::vector<ArrowSchema*> child_pointers;
+};
+
+struct ExportedArrowArray {
+  // Keeps the region mapped until the array is released
+  std::shared_ptr<const void> region;
+  std::vector<const void*> buffers;
+  // Buffers copied out of the region rather than pointing into it
+  std::vector<char> owned;
+  std::vector<ArrowArray> children;
+  std::vector<ArrowArray*> child_pointers;
+};
+
+inline void ReleaseExportedArrowSchema(ArrowSchema* schema) {
+  for (int64_t i = 0; i < schema->n_children; i++) {
+    if (schema->children[i]->release) {
+      schema->children[i]->release(schema->children[i]);
+    }
+  }
+  delete static_cast<ExportedArrowSchema*>(schema->private_data);
+  schema->release = nullptr;
+}
+
+inline void ReleaseExportedArrowArray(ArrowArray* array) {
+  for (int64_t i = 0; i < array->n_children; i++) {
+    if (array->children[i]->release) {
+      array->children[i]->release(array->children[i]);
+    }
+  }
+  delete static_cast<ExportedArrowArray*>(array->private_data);
+  array->release = nullptr;
+}
+
+inline ArrowSchema ExportArrowSchema(std::string format, std::string name, size_t n_children) {
+  auto exported = new ExportedArrowSchema{std::move(format), std::move(name), {}, {}};
+  exported->children.resize(n_children);
+  for (auto& child : exported->children) {
+    exported->child_pointers.push_back(&child);
+  }
+  ArrowSchema schema{};
+  schema.format = exported->format.c_str();
+  schema.name = exported->name.c_str();
+  schema.flags = ARROW_FLAG_NULLABLE;
+  schema.n_children = n_children;
+  schema.children = n_children ? exported->child_pointers.data() : nullptr;
+  schema.release = ReleaseExportedArrowSchema;
+  schema.private_data = exported;
+  return schema;
+}
+
+inline ArrowArray ExportArrowArray(std::shared_ptr<const void> region, int64_t length, int64_t null_count,
+                                   std::vector<const void*> buffers, size_t n_children,
+                                   std::vector<char> owned = {}) {
+  auto exported = new ExportedArrowArray{std::move(region), std::move(buffers), std::move(owned), {}, {}};
+  exported->children.resize(n_children);
+  for (auto& child : exported->children) {
+    exported->child_pointers.push_back(&child);
+  }
+  ArrowArray array{};
+  array.length = length;
+  array.null_count = null_count;
+  array.n_buffers = exported->buffers.size();
+  array.buffers = exported->buffers.data();
+  array.n_children = n_children;
+  array.children = n_children ? exported->child_pointers.data() : nullptr;
+  array.release = ReleaseExportedArrowArray;
+  array.private_data = exported;
+  return array;
+}
+
+// Record batch `name` a script placed in the `data_size` bytes of `region`
+// as described by `entry`, see PlanArrowTable. Its buffers point into the
+// region, which stays mapped until it is released, except for the offsets.
+// Those are copied out before they are checked, a process still mapping the
+// region could rewrite them afterwards. Returns why the entry is invalid, or
+// an empty string.
+inline std::string ImportArrowTable(std::shared_ptr<const void> region, size_t data_size,
+                                    const std::string& name, const Json::Value& entry,
+                                    CortexArrowTable& table) {
+  auto bytes = static_cast<const char*>(region.get());
+  std::string prefix = "Output table " + name;
+  if (!entry.isObject() || !entry["length"].isUInt64() || !entry["columns"].isArray()) {
+    return prefix + " has no valid description";
+  }
+  int64_t length = entry["length"].asUInt64();
+  if (length < 0 || static_cast<uint64_t>(length) > data_size * 8) {
+    return prefix + " has an invalid length";
+  }
+  const Json::Value& columns = entry["columns"];
+
+  // Buffer `b` of `column`, which must hold at least `size` bytes
+  auto buffer = [&](const Json::Value& column, int b, uint64_t size, const void*& data) {
+    const Json::Value& location = column["buffers"][b];
+    if (!location.isArray() || location.size() != 2 || !location[0].isUInt64() ||
+        !location[1].isUInt64()) {
+      return false;
+    }
+    uint64_t offset = location[0].asUInt64();
+    if (offset % 8 != 0 || offset > data_size || location[1].asUInt64() > data_size - offset ||
+        location[1].asUInt64() < size) {
+      return false;
+    }
+    data = bytes + offset;
+    return true;
+  };
+
+  ArrowSchema schema = ExportArrowSchema("+s", name, columns.size());
+  ArrowArray array = ExportArrowArray(region, length, 0, {nullptr}, columns.size());
+  table = CortexArrowTable(name, schema, array);
+  for (Json::ArrayIndex i = 0; i < columns.size(); i++) {
+    const Json::Value& column = columns[i];
+    if (!column.isObject() || !column["name"].isString() || !column["format"].isString() ||
+        !column["null_count"].isInt64() || !column["buffers"].isArray()) {
+      return prefix + " has an invalid column";
+    }
+    std::string format = column["format"].asString();
+    std::string column_name = column["name"].asString();
+    int64_t null_count = column["null_count"].asInt64();
+    int offset_width = ArrowOffsetWidth(format);
+    if (!IsSharedArrowFormat(format) || column["buffers"].size() != (offset_width ? 3u : 2u) ||
+        null_count < 0 || null_count > length) {
+      return prefix + " column " + column_name + " does not match its format";
+    }
+
+    std::vector<const void*> buffers(column["buffers"].size(), nullptr);
+    std::vector<char> offsets;
+    bool valid = column["buffers"][0].isNull()
+                     ? null_count == 0
+                     : buffer(column, 0, ArrowBitmapSize(length), buffers[0]);
+    if (offset_width) {
+      valid = valid && buffer(column, 1, (length + 1) * offset_width, buffers[1]) &&
+              buffer(column, 2, 0, buffers[2]);
+      if (valid) {
+        auto first = static_cast<const char*>(buffers[1]);
+        offsets.assign(first, first + (length + 1) * offset_width);
+        buffers[1] = offsets.data();
+      }
+      // Offsets must stay within the values, which the caller reads by them
+      int64_t values_size = valid ? column["buffers"][2][1].asUInt64() : 0;
+      for (int64_t j = 0; valid && j <= length; j++) {
+        int64_t offset = ArrowOffset(buffers[1], offset_width, j);
+        valid = offset >= 0 && offset <= values_size &&
+                (j == 0 || offset >= ArrowOffset(buffers[1], offset_width, j - 1));
+      }
+    } else {
+      uint64_t size = format == "b" ? ArrowBitmapSize(length) : length * ArrowValueWidth(format);
+      valid = valid && buffer(column, 1, size, buffers[1]);
+    }
+    if (!valid) {
+      return prefix + " column " + column_name + " has invalid buffers";
+    }
+    *table.schema.children[i] = ExportArrowSchema(format, column_name, 0);
+    *table.array.children[i] = ExportArrowArray(region, length, null_count, std::move(buffers), 0,
+                                                std::move(offsets));
+  }
+  return "";
+}
+
+} // namespace python_utils
+#endif
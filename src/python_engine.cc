@@ -1,20 +1,51 @@
 #include "python_engine.h"
+
+#include <cstring>
+#include <thread>
+
 #include "python_utils.h"
+#include "python_worker.h"
 #include "trantor/utils/Logger.h"
 
 #if defined(_WIN32)
   #include <process.h>
 #else
-  #include <spawn.h>
   #include <sys/wait.h>
-  extern char **environ;
+
+  #include "process_spawn.h"
 #endif
 
 constexpr const int k200OK = 200;
+constexpr const int k202Accepted = 202;
 constexpr const int k400BadRequest = 400;
+constexpr const int k404NotFound = 404;
+constexpr const int k429TooManyRequests = 429;
 constexpr const int k500InternalServerError = 500;
+constexpr const int k504GatewayTimeout = 504;
+
+#if !defined(_WIN32)
+// Lightweight executable running Python in child processes
+constexpr const char* kRunnerExeName = "cortex-python-runner";
+#endif
+
+extern "C" CortexPythonEngineI* get_engine();
 
-PythonEngine::~PythonEngine() {}
+namespace Admission = PythonRuntime::Admission;
+namespace EngineConfig = PythonRuntime::EngineConfig;
+
+// Finished asynchronous jobs are kept this long for their results to be fetched
+constexpr const std::chrono::seconds kJobRetention = std::chrono::hours(1);
+constexpr const size_t kMaxFinishedJobs = 10000;
+
+PythonEngine::PythonEngine()
+    : job_table_(kJobRetention, kMaxFinishedJobs),
+      admission_queue_(config_.max_concurrent_executions, config_.max_queued_executions) {}
+
+PythonEngine::~PythonEngine() {
+  // Executions in flight still call back into the engine
+  std::unique_lock<std::mutex> l(executions_mtx_);
+  executions_cond_.wait(l, [this] { return executions_in_flight_ == 0; });
+}
 
 void PythonEngine::ExecutePythonFile(
     std::string binary_execute_path,
@@ -34,25 +65,591 @@ void PythonEngine::HandlePythonFileExecutionRequest(
       std::move(callback));
 }
 
+bool PythonEngine::HandlePythonFileStreamingRequest(
+    std::shared_ptr<Json::Value> json_body,
+    std::function<void(Json::Value&&)>&& on_output,
+    std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+
+  auto request = PythonRuntime::PythonFileExecution::FromJson(json_body);
+#if defined(_WIN32)
+  std::string error = "Streaming executions are not supported on Windows";
+#else
+  std::string error = request.is_async ? "Streaming executions cannot be asynchronous" : "";
+#endif
+  if (error != "") {
+    LOG_ERROR << error;
+    Json::Value json_resp;
+    Json::Value status_resp;
+    json_resp["message"] = error;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return false;
+  }
+
+  request.capture_output = true;
+  request.on_output = std::move(on_output);
+  return HandlePythonFileExecutionRequestImpl(std::move(request), std::move(callback));
+}
+
+void PythonEngine::HandlePythonTableExecutionRequest(
+    std::shared_ptr<Json::Value> json_body,
+    std::vector<CortexArrowTable>&& tables,
+    std::function<void(Json::Value&&, Json::Value&&, std::vector<CortexArrowTable>&&)>&& callback) {
+
+  auto request = PythonRuntime::PythonFileExecution::FromJson(json_body);
+#if defined(_WIN32)
+  std::string error = "Table executions are not supported on Windows";
+#else
+  // Finished jobs keep JSON results only
+  std::string error = request.is_async ? "Table executions cannot be asynchronous" : "";
+#endif
+  if (error != "") {
+    LOG_ERROR << error;
+    Json::Value json_resp;
+    Json::Value status_resp;
+    json_resp["message"] = error;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp), {});
+    return;
+  }
+
+  request.tables = std::make_shared<std::vector<CortexArrowTable>>(std::move(tables));
+  auto output_tables = std::make_shared<std::vector<CortexArrowTable>>();
+  request.output_tables = output_tables;
+  HandlePythonFileExecutionRequestImpl(
+      std::move(request), [output_tables, callback = std::move(callback)](Json::Value&& status_resp,
+                                                                         Json::Value&& json_resp) {
+        callback(std::move(status_resp), std::move(json_resp), std::move(*output_tables));
+      });
+}
+
+int PythonEngine::RunPythonWorker(
+    std::string binary_execute_path,
+    std::string python_library_path) {
+#if defined(_WIN32)
+  LOG_ERROR << "Python workers are not supported on Windows";
+  return 1;
+#else
+  python_worker::PythonRuntimeArgs runtime;
+  runtime.python_library_path = python_library_path;
+  return python_worker::RunPythonWorker(
+      python_utils::GetDefaultPythonLibraryPath(binary_execute_path), runtime);
+#endif
+}
+
+int PythonEngine::RunPythonForkServer(
+    std::string binary_execute_path,
+    std::string python_library_path) {
+#if defined(_WIN32)
+  LOG_ERROR << "Python fork server is not supported on Windows";
+  return 1;
+#else
+  python_worker::PythonRuntimeArgs runtime;
+  runtime.python_library_path = python_library_path;
+  return python_worker::RunPythonZygote(
+      python_utils::GetDefaultPythonLibraryPath(binary_execute_path), runtime);
+#endif
+}
+
+int PythonEngine::RunPythonChildProcess(
+    std::string binary_execute_path,
+    int argc,
+    char** argv) {
+#if defined(_WIN32)
+  // Children on Windows only get the file and the library path
+  if (argc > 2 && strcmp(argv[1], "--run_python_file") == 0) {
+    ExecutePythonFile(binary_execute_path, argv[2], argc > 3 ? argv[3] : "");
+    return 0;
+  }
+  LOG_ERROR << "Python workers and fork server are not supported on Windows";
+  return 1;
+#else
+  return python_worker::RunPythonChildProcess(
+      python_utils::GetDefaultPythonLibraryPath(binary_execute_path), argc, argv);
+#endif
+}
+
+void PythonEngine::HandleEngineConfigRequest(
+    std::shared_ptr<Json::Value> json_body,
+    std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+
+  Json::Value json_resp;
+  Json::Value status_resp;
+
+  std::unique_lock<std::mutex> l(mtx_);
+  auto config = EngineConfig::FromJson(json_body, config_);
+  if (!EngineConfig::IsValidExecutionMode(config.execution_mode)) {
+    l.unlock();
+    LOG_ERROR << "Unknown execution mode " << config.execution_mode;
+    json_resp["message"] = "Unknown execution mode " + config.execution_mode;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+  if (!EngineConfig::IsValidSpawnStrategy(config.spawn_strategy)) {
+    l.unlock();
+    LOG_ERROR << "Unknown spawn strategy " << config.spawn_strategy;
+    json_resp["message"] = "Unknown spawn strategy " + config.spawn_strategy;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+
+  for (const auto& [tenant, weight] : config.tenant_weights) {
+    if (weight <= 0) {
+      l.unlock();
+      LOG_ERROR << "Weight of tenant " << tenant << " must be positive";
+      json_resp["message"] = "Weight of tenant " + tenant + " must be positive";
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+  }
+  if (config.startup_profiles.find(config.startup_profile) == config.startup_profiles.end()) {
+    l.unlock();
+    LOG_ERROR << "Unknown startup profile " << config.startup_profile;
+    json_resp["message"] = "Unknown startup profile " + config.startup_profile;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+  for (const auto& [name, profile] : config.startup_profiles) {
+    std::string error = profile.Validate();
+    if (error != "") {
+      l.unlock();
+      LOG_ERROR << "Invalid startup profile " << name << ": " << error;
+      json_resp["message"] = "Invalid startup profile " + name + ": " + error;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+  }
+  if (config.worker_pool_size < 0 || config.worker_pool_size > EngineConfig::kMaxWorkerPoolSize ||
+      config.max_jobs_per_worker < 0) {
+    l.unlock();
+    std::string message = "worker_pool_size must be between 0 and " +
+                          std::to_string(EngineConfig::kMaxWorkerPoolSize) +
+                          " and max_jobs_per_worker must not be negative";
+    LOG_ERROR << message;
+    json_resp["message"] = message;
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+  if (config.max_concurrent_executions < 0 || config.max_queued_executions < 0 ||
+      config.default_timeout_ms < 0 || config.timeout_grace_period_ms < 0 ||
+      config.max_output_bytes < 0) {
+    l.unlock();
+    LOG_ERROR << "Execution limits must not be negative";
+    json_resp["message"] = "Execution limits must not be negative";
+    status_resp["status_code"] = k400BadRequest;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+
+  if (config.bytecode_cache_dir != "") {
+    std::error_code ec;
+    std::filesystem::create_directories(config.bytecode_cache_dir, ec);
+    if (ec) {
+      l.unlock();
+      LOG_ERROR << "Failed to create bytecode cache directory " << config.bytecode_cache_dir << ": " << ec.message();
+      json_resp["message"] = "Failed to create bytecode cache directory " + config.bytecode_cache_dir;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+  }
+
+  config_ = config;
+#if !defined(_WIN32)
+  // Pools pick up the new settings when they are created again, in flight
+  // executions keep their pool alive until they are done. The others are
+  // destroyed once unlocked, as they wait for their processes or scripts.
+  auto worker_pools = std::move(worker_pools_);
+  worker_pools_.clear();
+  auto fork_servers = std::move(fork_servers_);
+  fork_servers_.clear();
+  auto subinterpreter_pools = std::move(subinterpreter_pools_);
+  subinterpreter_pools_.clear();
+#endif
+  l.unlock();
+
+  // Raised limits admit queued executions, which lock mtx_ to start
+  admission_queue_.SetTenantWeights(config.tenant_weights);
+  start_dispatcher_.Dispatch(
+      admission_queue_.SetLimits(config.max_concurrent_executions, config.max_queued_executions));
+
+  json_resp["message"] = "Engine config updated";
+  status_resp["status_code"] = k200OK;
+  callback(std::move(status_resp), std::move(json_resp));
+}
+
+void PythonEngine::HandleEngineStatsRequest(
+    std::shared_ptr<Json::Value> /*json_body*/,
+    std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+
+  Json::Value json_resp;
+  Json::Value status_resp;
+  json_resp["imports"] = import_stats_.ToJson();
+  status_resp["status_code"] = k200OK;
+  callback(std::move(status_resp), std::move(json_resp));
+}
 
-void PythonEngine::HandlePythonFileExecutionRequestImpl(
+bool PythonEngine::HandlePythonFileExecutionRequestImpl(
     PythonRuntime::PythonFileExecution::PythonFileExecutionRequest&& request,
     std::function<void(Json::Value&&, Json::Value&&)> && callback) {
 
   std::string file_execution_path = request.file_execution_path;
-  std::string python_library_path = request.python_library_path;
 
   Json::Value json_resp;
   Json::Value status_resp;
 
-  if (file_execution_path == "") {
+  if (file_execution_path == "" && request.code == "") {
       LOG_ERROR << "No specified Python file path";
       json_resp["message"] = "No specified Python file path";
       status_resp["status_code"] = k400BadRequest;
       callback(std::move(status_resp), std::move(json_resp));
-      return;
+      return false;
+  }
+
+  if (file_execution_path != "" && request.code != "") {
+      LOG_ERROR << "Both a Python file path and code are specified";
+      json_resp["message"] = "Only one of file_execution_path and code may be specified";
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+  }
+
+  std::string execution_mode = request.execution_mode;
+  if (execution_mode == "") {
+    std::lock_guard<std::mutex> l(mtx_);
+    execution_mode = config_.execution_mode;
+  } else if (!EngineConfig::IsValidExecutionMode(execution_mode)) {
+      LOG_ERROR << "Unknown execution mode " << execution_mode;
+      json_resp["message"] = "Unknown execution mode " + execution_mode;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+  }
+
+  request.execution_mode = execution_mode;
+
+  if (request.timeout_ms < 0) {
+      LOG_ERROR << "Timeout must not be negative";
+      json_resp["message"] = "Timeout must not be negative";
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+  }
+
+  bool known_startup_profile;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (request.startup_profile == "") {
+      request.startup_profile = config_.startup_profile;
+    }
+    known_startup_profile =
+        config_.startup_profiles.find(request.startup_profile) != config_.startup_profiles.end();
+  }
+  if (!known_startup_profile) {
+      LOG_ERROR << "Unknown startup profile " << request.startup_profile;
+      json_resp["message"] = "Unknown startup profile " + request.startup_profile;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+  }
+
+  if (request.code != "") {
+#if defined(_WIN32)
+    std::string error = "Inline code is not supported on Windows";
+#else
+    std::string error = python_utils::ScriptSource(request.code).Validate();
+    if (error != "") {
+      error = "Invalid Python code: " + error;
+    }
+#endif
+    if (error != "") {
+      LOG_ERROR << error;
+      json_resp["message"] = error;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+    }
+#if !defined(_WIN32)
+    request.inline_code = PythonInlineCode::Create(request.code);
+    request.code = "";
+    if (!request.inline_code) {
+      LOG_ERROR << "Failed to create memory for inline code: " << strerror(errno);
+      json_resp["message"] = "Failed to pass the code to the Python execution";
+      status_resp["status_code"] = k500InternalServerError;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+    }
+#endif
+  }
+
+  if (request.UsesSharedBlobs()) {
+#if defined(_WIN32)
+    std::string error = "Shared blobs are not supported on Windows";
+#else
+    std::string error = PythonSharedBlobs::ValidateInputs(request.inputs ? *request.inputs : Json::Value());
+    if (error == "" && request.tables) {
+      error = PythonSharedBlobs::ValidateTables(*request.tables);
+    }
+#endif
+    if (error != "") {
+      LOG_ERROR << error;
+      json_resp["message"] = error;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+    }
+#if !defined(_WIN32)
+    std::vector<CortexArrowTable> no_tables;
+    request.blobs = PythonSharedBlobs::Create(request.inputs ? *request.inputs : Json::Value(),
+                                              request.tables ? *request.tables : no_tables,
+                                              request.output_tables);
+    // The body and the tables of the caller, which may be large, are not
+    // needed any longer
+    request.inputs.reset();
+    request.tables.reset();
+    if (!request.blobs) {
+      LOG_ERROR << "Failed to create shared memory for the blobs: " << strerror(errno);
+      json_resp["message"] = "Failed to share the blobs of the Python file execution";
+      status_resp["status_code"] = k500InternalServerError;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+    }
+#endif
+  }
+
+  Admission::PriorityClass priority;
+  if (!Admission::ParsePriorityClass(request.priority, priority)) {
+      LOG_ERROR << "Unknown priority " << request.priority;
+      json_resp["message"] = "Unknown priority " + request.priority;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+  }
+
+  if (request.HasResourceLimits()) {
+    std::string error = ValidateResourceLimits(request);
+    if (error != "") {
+      LOG_ERROR << error;
+      json_resp["message"] = error;
+      status_resp["status_code"] = k400BadRequest;
+      callback(std::move(status_resp), std::move(json_resp));
+      return false;
+    }
+  }
+
+  if (request.is_async) {
+    std::string job_id = job_table_.Create();
+    bool admitted = RunPythonFileExecution(request, [this, job_id](Json::Value&& job_status_resp,
+                                                                   Json::Value&& job_json_resp) {
+      job_json_resp["job_id"] = job_id;
+      job_table_.Finish(job_id, std::move(job_status_resp), std::move(job_json_resp));
+    });
+    if (!admitted) {
+      job_table_.Remove(job_id);
+      RejectPythonFileExecution(std::move(callback));
+      return false;
+    }
+
+    LOG_INFO << "Submitted Python file execution job " << job_id;
+    json_resp["message"] = "Python file execution submitted";
+    json_resp["job_id"] = job_id;
+    status_resp["status_code"] = k202Accepted;
+    callback(std::move(status_resp), std::move(json_resp));
+    return true;
+  }
+
+  // Kept here as well, the rejection is answered through it
+  auto shared_callback = std::make_shared<ExecutionCallback>(std::move(callback));
+  bool admitted = RunPythonFileExecution(request, [shared_callback](Json::Value&& status_resp,
+                                                                    Json::Value&& json_resp) {
+    (*shared_callback)(std::move(status_resp), std::move(json_resp));
+  });
+  if (!admitted) {
+    RejectPythonFileExecution(std::move(*shared_callback));
+  }
+  return admitted;
+}
+
+void PythonEngine::AddImportProfile(Json::Value& result, Json::Value& json_resp) {
+  if (!result.isMember("imports")) {
+    return;
+  }
+  import_stats_.Add(result["imports"]);
+  json_resp["imports"] = std::move(result["imports"]);
+}
+
+void PythonEngine::RejectPythonFileExecution(ExecutionCallback&& callback) {
+  Json::Value json_resp;
+  Json::Value status_resp;
+
+  int retry_after = admission_queue_.RetryAfterSeconds();
+  LOG_WARN << "Too many Python file executions, rejecting the request";
+  json_resp["message"] = "Too many Python file executions, retry later";
+  json_resp["retry_after"] = retry_after;
+  status_resp["status_code"] = k429TooManyRequests;
+  status_resp["retry_after"] = retry_after;
+  callback(std::move(status_resp), std::move(json_resp));
+}
+
+std::string PythonEngine::ValidateResourceLimits(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  if (request.cpu_quota < 0 || request.memory_limit_mb < 0 || request.pids_max < 0) {
+    return "Resource limits must not be negative";
+  }
+#if defined(__linux__)
+  if (request.execution_mode == EngineConfig::kExecutionModeWorkerPool ||
+      request.execution_mode == EngineConfig::kExecutionModeSubinterpreter) {
+    // Workers and threads are shared by executions, they cannot be limited
+    // per request
+    return "Resource limits are not supported in " + request.execution_mode + " mode";
+  }
+  std::lock_guard<std::mutex> l(mtx_);
+  if (config_.cgroup_root == "") {
+    return "Resource limits need a cgroup_root in the engine config";
+  }
+  return "";
+#else
+  return "Resource limits are only supported on Linux";
+#endif
+}
+
+void PythonEngine::HandleJobStatusRequest(
+    std::shared_ptr<Json::Value> json_body,
+    std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+
+  Json::Value json_resp;
+  Json::Value status_resp;
+
+  std::string job_id = json_body ? json_body->get("job_id", "").asString() : "";
+  if (!job_table_.GetStatus(job_id, json_resp)) {
+    json_resp["message"] = "Job not found";
+    status_resp["status_code"] = k404NotFound;
+  } else {
+    status_resp["status_code"] = k200OK;
+  }
+  callback(std::move(status_resp), std::move(json_resp));
+}
+
+void PythonEngine::HandleJobResultRequest(
+    std::shared_ptr<Json::Value> json_body,
+    std::function<void(Json::Value&&, Json::Value&&)>&& callback) {
+
+  Json::Value json_resp;
+  Json::Value status_resp;
+
+  std::string job_id = json_body ? json_body->get("job_id", "").asString() : "";
+  if (job_table_.GetResult(job_id, status_resp, json_resp)) {
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+
+  if (!job_table_.GetStatus(job_id, json_resp)) {
+    json_resp["message"] = "Job not found";
+    status_resp["status_code"] = k404NotFound;
+  } else {
+    json_resp["message"] = "Job is still running";
+    status_resp["status_code"] = k202Accepted;
+  }
+  callback(std::move(status_resp), std::move(json_resp));
+}
+
+bool PythonEngine::RunPythonFileExecution(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    ExecutionCallback&& callback) {
+
+  // Queued executions count as in flight too, they start once a slot frees up
+  {
+    std::lock_guard<std::mutex> l(executions_mtx_);
+    executions_in_flight_++;
+  }
+  // Validated by HandlePythonFileExecutionRequestImpl
+  auto priority = Admission::PriorityClass::kNormal;
+  Admission::ParsePriorityClass(request.priority, priority);
+  auto admission = admission_queue_.Submit(
+      [this, request, callback = std::move(callback)]() mutable {
+        StartPythonFileExecution(request, std::move(callback));
+      },
+      priority, request.tenant);
+  if (admission == Admission::AdmissionResult::kRejected) {
+    std::lock_guard<std::mutex> l(executions_mtx_);
+    executions_in_flight_--;
+    executions_cond_.notify_all();
+    return false;
+  }
+  return true;
+}
+
+void PythonEngine::StartPythonFileExecution(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    ExecutionCallback&& callback) {
+
+  auto started_at = std::chrono::steady_clock::now();
+  std::shared_ptr<PythonExecutionTimeout> timeout;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    int64_t timeout_ms = request.timeout_ms > 0 ? request.timeout_ms : config_.default_timeout_ms;
+    if (timeout_ms > 0) {
+      timeout = std::make_shared<PythonExecutionTimeout>(
+          started_at + std::chrono::milliseconds(timeout_ms),
+          std::chrono::milliseconds(config_.timeout_grace_period_ms));
+    }
+  }
+
+  ExecutionCallback done = [this, callback = std::move(callback), started_at, timeout](
+                               Json::Value&& status_resp, Json::Value&& json_resp) {
+    if (timeout && timeout->Finish()) {
+      json_resp = Json::Value();
+      json_resp["message"] = "Python file execution timed out";
+      json_resp["timed_out"] = true;
+      status_resp["status_code"] = k504GatewayTimeout;
+    }
+    callback(std::move(status_resp), std::move(json_resp));
+
+    // May hand out the slot to a queued execution, before this one stops
+    // being in flight
+    start_dispatcher_.Dispatch(admission_queue_.Finish(std::chrono::steady_clock::now() - started_at));
+    std::lock_guard<std::mutex> l(executions_mtx_);
+    executions_in_flight_--;
+    executions_cond_.notify_all();
+  };
+
+  const std::string& execution_mode = request.execution_mode;
+  if (execution_mode == EngineConfig::kExecutionModeWorkerPool ||
+      execution_mode == EngineConfig::kExecutionModeForkServer ||
+      execution_mode == EngineConfig::kExecutionModeSubinterpreter) {
+#if defined(_WIN32)
+    LOG_WARN << "Execution mode " << execution_mode << " is not supported on Windows, spawning a child process instead";
+    SpawnPythonFileExecution(request, timeout, std::move(done));
+#else
+    if (execution_mode == EngineConfig::kExecutionModeWorkerPool) {
+      RunOnWorkerPool(request, timeout, std::move(done));
+    } else if (execution_mode == EngineConfig::kExecutionModeSubinterpreter) {
+      RunOnSubinterpreterPool(request, timeout, std::move(done));
+    } else {
+      RunOnForkServer(request, timeout, std::move(done));
+    }
+#endif
+  } else {
+    SpawnPythonFileExecution(request, timeout, std::move(done));
   }
+}
+
+void PythonEngine::SpawnPythonFileExecution(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    std::shared_ptr<PythonExecutionTimeout> timeout,
+    ExecutionCallback&& callback) {
+
+  std::string file_execution_path = request.file_execution_path;
+  std::string python_library_path = request.python_library_path;
 
+  Json::Value json_resp;
+  Json::Value status_resp;
   json_resp["message"] = "Executing the Python file";
   status_resp["status_code"] = k200OK;
 
@@ -74,42 +671,547 @@ void PythonEngine::HandlePythonFileExecutionRequestImpl(
                       NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi)) {
       LOG_ERROR << "Failed to create child process: " << GetLastError();
       json_resp["message"] = "Failed to execute the Python file";
+      callback(std::move(status_resp), std::move(json_resp));
   } else {
     LOG_INFO << "Created child process for Python embedding";
-    WaitForSingleObject(pi.hProcess, INFINITE);
+    // No reactor on Windows, a thread waits for the child instead
+    std::thread([pi, status_resp = std::move(status_resp), json_resp = std::move(json_resp),
+                 callback = std::move(callback), timeout]() mutable {
+      DWORD wait_ms = INFINITE;
+      if (timeout) {
+        auto remaining = timeout->deadline() - std::chrono::steady_clock::now();
+        wait_ms = static_cast<DWORD>(std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+      }
+      if (WaitForSingleObject(pi.hProcess, wait_ms) == WAIT_TIMEOUT) {
+        // No process groups to signal here, the child is terminated right away
+        LOG_WARN << "Python execution timed out, terminating it";
+        timeout->MarkTimedOut();
+        TerminateProcess(pi.hProcess, 1);
+        WaitForSingleObject(pi.hProcess, INFINITE);
+      }
+      CloseHandle(pi.hProcess);
+      CloseHandle(pi.hThread);
+      callback(std::move(status_resp), std::move(json_resp));
+    }).detach();
   }
 #else
-  std::string child_process_exe_path = python_utils::getCurrentExecutablePath();
-  std::vector<char*> child_process_args;
-  child_process_args.push_back(const_cast<char*>(child_process_exe_path.c_str()));
-  child_process_args.push_back(const_cast<char*>("--run_python_file"));
-  child_process_args.push_back(const_cast<char*>(file_execution_path.c_str()));
-  if (python_library_path != "")
-      child_process_args.push_back(const_cast<char*>(python_library_path.c_str()));
+  // Inline code is read from its descriptor, the name only shows in tracebacks
+  std::vector<std::string> child_process_args = {
+      "--run_python_file", request.inline_code ? python_utils::kInlineCodeName : file_execution_path};
+  auto runtime = GetChildRuntimeArgs(request);
+  runtime.profile_imports = request.profile_imports;
+  runtime.shared_blobs = request.blobs != nullptr;
+  runtime.inline_code = request.inline_code != nullptr;
 
-  pid_t pid;
+#if defined(__linux__)
+  std::shared_ptr<cgroup::CgroupManager> cgroup_manager;
+  std::string cgroup_path;
+  if (request.HasResourceLimits() &&
+      !CreateExecutionCgroup(request, cgroup_manager, cgroup_path)) {
+    json_resp["message"] = "Failed to limit the resources of the Python file execution";
+    status_resp["status_code"] = k500InternalServerError;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+  // The runner joins it before starting Python, so nothing of the script
+  // runs unlimited
+  runtime.cgroup_path = cgroup_path;
+#endif
+  runtime.AppendTo(child_process_args);
+
+  std::vector<process_spawn::FdMapping> fd_mappings;
+  if (request.capture_output) {
+    auto capture = CreateOutputCapture(request);
+    if (!capture) {
+#if defined(__linux__)
+      if (cgroup_manager) {
+        cgroup_manager->RemoveLeaf(cgroup_path);
+      }
+#endif
+      json_resp["message"] = "Failed to capture the output of the Python file execution";
+      status_resp["status_code"] = k500InternalServerError;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+    fd_mappings = {{capture->stdout_fd(), STDOUT_FILENO}, {capture->stderr_fd(), STDERR_FILENO}};
+    callback = [capture, callback = std::move(callback)](Json::Value&& status_resp,
+                                                          Json::Value&& json_resp) {
+      capture->Finish(json_resp);
+      callback(std::move(status_resp), std::move(json_resp));
+    };
+  }
+  if (request.inline_code) {
+    fd_mappings.push_back({request.inline_code->fd(), python_worker::kInlineCodeFd});
+  }
+  if (request.blobs) {
+    fd_mappings.push_back({request.blobs->fds().input_fd, python_worker::kSharedBlobInputFd});
+    fd_mappings.push_back({request.blobs->fds().output_fd, python_worker::kSharedBlobOutputFd});
+    callback = [blobs = request.blobs, callback = std::move(callback)](Json::Value&& status_resp,
+                                                                        Json::Value&& json_resp) {
+      blobs->AddOutputs(json_resp);
+      callback(std::move(status_resp), std::move(json_resp));
+    };
+  }
 
-  int status = posix_spawn(&pid, child_process_exe_path.c_str(), nullptr, 
-                           nullptr, child_process_args.data(), environ);
-                
+  pid_t pid;
+  int status;
+  // Profiled children report their imports over a channel, like workers
+  int channel_fd = -1;
+  if (request.profile_imports) {
+    channel_fd = python_worker::SpawnWithChannel(GetChildProcessExePath(), child_process_args,
+                                                 GetSpawnStrategy(), pid, fd_mappings);
+    status = channel_fd < 0 ? errno : 0;
+  } else {
+    status = process_spawn::SpawnProcess(GetSpawnStrategy(), GetChildProcessExePath(),
+                                         child_process_args, fd_mappings, pid);
+  }
   if (status) {
     LOG_ERROR << "Failed to spawn process: " << strerror(status);
+#if defined(__linux__)
+    if (cgroup_manager) {
+      cgroup_manager->RemoveLeaf(cgroup_path);
+    }
+#endif
     json_resp["message"] = "Failed to execute the Python file";
     status_resp["status_code"] = k500InternalServerError;
-  } else {
-    LOG_INFO << "Created child process for Python embedding";
-    int stat_loc;
-    if (waitpid(pid, &stat_loc, 0) == -1) {
-      LOG_ERROR << "Error waiting for child process";
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+
+  LOG_INFO << "Created child process for Python embedding";
+  if (timeout) {
+    timeout->Arm(GetReactor(), pid);
+  }
+  if (channel_fd >= 0) {
+    // Drained while the child runs, so a large report never blocks it. Once
+    // it exited, whatever it sent is already readable.
+    auto channel = std::make_shared<python_worker::MessageChannel>(channel_fd);
+    auto& reactor = GetReactor();
+    reactor.WatchFd(channel_fd, [channel, &reactor] {
+      if (!channel->ReadAvailable()) {
+        reactor.UnwatchFd(channel->fd());
+      }
+    });
+    callback = [this, channel, &reactor, callback = std::move(callback)](
+                   Json::Value&& status_resp, Json::Value&& json_resp) {
+      channel->ReadAvailable();
+      reactor.UnwatchFd(channel->fd());
+      close(channel->fd());
+      Json::Value result;
+      if (channel->PopMessage(result)) {
+        AddImportProfile(result, json_resp);
+      }
+      callback(std::move(status_resp), std::move(json_resp));
+    };
+  }
+#if defined(__linux__)
+  GetReactor().WatchChild(pid, [status_resp = std::move(status_resp), json_resp = std::move(json_resp),
+                            callback = std::move(callback), cgroup_manager, cgroup_path](int status) mutable {
+    if (cgroup_manager) {
+      cgroup_manager->RemoveLeaf(cgroup_path);
+      if (WIFEXITED(status) && WEXITSTATUS(status) == python_worker::kCgroupJoinFailedExitCode) {
+        json_resp["message"] = "Failed to limit the resources of the Python file execution";
+        status_resp["status_code"] = k500InternalServerError;
+      }
+    }
+    callback(std::move(status_resp), std::move(json_resp));
+  });
+#else
+  GetReactor().WatchChild(pid, [status_resp = std::move(status_resp), json_resp = std::move(json_resp),
+                            callback = std::move(callback)](int) mutable {
+    callback(std::move(status_resp), std::move(json_resp));
+  });
+#endif
+#endif
+}
+
+#if !defined(_WIN32)
+void PythonEngine::RunOnWorkerPool(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    std::shared_ptr<PythonExecutionTimeout> timeout,
+    ExecutionCallback&& callback) {
+
+  auto pool = GetWorkerPool(request);
+
+  // A worker which outlives the deadline is killed and replaced
+  PythonWorkerPool::StartedCallback on_started;
+  if (timeout) {
+    on_started = [timeout, &reactor = GetReactor()](pid_t worker_pid) {
+      timeout->Arm(reactor, worker_pid);
+    };
+  }
+
+  Json::Value job;
+  job["file_execution_path"] = request.file_execution_path;
+  if (request.profile_imports) {
+    job["profile_imports"] = true;
+  }
+  // The worker points its stdout and stderr at the pipes for the job
+  std::shared_ptr<PythonOutputCapture> capture;
+  std::vector<int> fds;
+  if (request.capture_output) {
+    capture = CreateOutputCapture(request);
+    if (!capture) {
+      Json::Value json_resp;
+      Json::Value status_resp;
+      json_resp["message"] = "Failed to capture the output of the Python file execution";
+      status_resp["status_code"] = k500InternalServerError;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+    job["capture_output"] = true;
+    fds = {capture->stdout_fd(), capture->stderr_fd()};
+  }
+  // Followed by the shared memory of the blobs
+  if (request.blobs) {
+    job["shared_blobs"] = true;
+    fds.push_back(request.blobs->fds().input_fd);
+    fds.push_back(request.blobs->fds().output_fd);
+  }
+  if (request.inline_code) {
+    job["inline_code"] = true;
+    fds.push_back(request.inline_code->fd());
+  }
+  pool->Submit(std::move(job), [this, capture, blobs = request.blobs, inline_code = request.inline_code,
+                                callback = std::move(callback)](bool done, Json::Value&& result) {
+    Json::Value json_resp;
+    Json::Value status_resp;
+    if (done) {
+      json_resp["message"] = "Executing the Python file";
+      status_resp["status_code"] = k200OK;
+      AddImportProfile(result, json_resp);
+      if (blobs) {
+        blobs->AddOutputs(json_resp);
+      }
+    } else {
       json_resp["message"] = "Failed to execute the Python file";
       status_resp["status_code"] = k500InternalServerError;
     }
+    if (capture) {
+      capture->Finish(json_resp);
+    }
+    callback(std::move(status_resp), std::move(json_resp));
+  }, std::move(on_started), std::move(fds));
+}
+
+void PythonEngine::RunOnForkServer(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    std::shared_ptr<PythonExecutionTimeout> timeout,
+    ExecutionCallback&& callback) {
+
+  auto fork_server = GetForkServer(request);
+
+  Json::Value job;
+  job["file_execution_path"] = request.file_execution_path;
+  if (request.profile_imports) {
+    job["profile_imports"] = true;
+  }
+  // The forked child points its stdout and stderr at the pipes
+  std::shared_ptr<PythonOutputCapture> capture;
+  std::vector<int> fds;
+  if (request.capture_output) {
+    capture = CreateOutputCapture(request);
+    if (!capture) {
+      Json::Value json_resp;
+      Json::Value status_resp;
+      json_resp["message"] = "Failed to capture the output of the Python file execution";
+      status_resp["status_code"] = k500InternalServerError;
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+    job["capture_output"] = true;
+    fds = {capture->stdout_fd(), capture->stderr_fd()};
+  }
+  // Followed by the shared memory of the blobs
+  if (request.blobs) {
+    job["shared_blobs"] = true;
+    fds.push_back(request.blobs->fds().input_fd);
+    fds.push_back(request.blobs->fds().output_fd);
+  }
+  if (request.inline_code) {
+    job["inline_code"] = true;
+    fds.push_back(request.inline_code->fd());
+  }
+
+  std::shared_ptr<cgroup::CgroupManager> cgroup_manager;
+  std::string cgroup_path;
+#if defined(__linux__)
+  if (request.HasResourceLimits()) {
+    if (!CreateExecutionCgroup(request, cgroup_manager, cgroup_path)) {
+      Json::Value json_resp;
+      Json::Value status_resp;
+      json_resp["message"] = "Failed to limit the resources of the Python file execution";
+      status_resp["status_code"] = k500InternalServerError;
+      if (capture) {
+        capture->Finish(json_resp);
+      }
+      callback(std::move(status_resp), std::move(json_resp));
+      return;
+    }
+    // The forked child joins it before running the file
+    job["cgroup_path"] = cgroup_path;
   }
 #endif
 
-  callback(std::move(status_resp), std::move(json_resp));
-  return;
-};
+  pid_t pid = fork_server->Submit(job, [this, callback = std::move(callback), cgroup_manager, cgroup_path,
+                            capture, blobs = request.blobs, timeout](bool done, Json::Value&& result) {
+    // Disarmed while the child waits for its channel to close, the zygote
+    // reaps it right after and its pid may be reused
+    if (timeout) {
+      timeout->Finish();
+    }
+#if defined(__linux__)
+    if (cgroup_manager) {
+      cgroup_manager->RemoveLeaf(cgroup_path);
+    }
+#endif
+    Json::Value json_resp;
+    Json::Value status_resp;
+    if (done) {
+      json_resp["message"] = "Executing the Python file";
+      status_resp["status_code"] = k200OK;
+      AddImportProfile(result, json_resp);
+      if (blobs) {
+        blobs->AddOutputs(json_resp);
+      }
+    } else {
+      json_resp["message"] = "Failed to execute the Python file";
+      status_resp["status_code"] = k500InternalServerError;
+    }
+    if (capture) {
+      capture->Finish(json_resp);
+    }
+    callback(std::move(status_resp), std::move(json_resp));
+  }, fds);
+  if (pid > 0 && timeout) {
+    timeout->Arm(GetReactor(), pid);
+  }
+}
+
+void PythonEngine::RunOnSubinterpreterPool(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    std::shared_ptr<PythonExecutionTimeout> timeout,
+    ExecutionCallback&& callback) {
+
+  Json::Value json_resp;
+  Json::Value status_resp;
+  auto pool = GetSubinterpreterPool(request.python_library_path);
+  if (!pool) {
+    json_resp["message"] = "Python subinterpreters are not available, they need Python 3.12 or later";
+    status_resp["status_code"] = k500InternalServerError;
+    callback(std::move(status_resp), std::move(json_resp));
+    return;
+  }
+
+  PythonSubinterpreterPool::JobOptions options;
+  options.profile_imports = request.profile_imports;
+  options.capture_output = request.capture_output;
+  if (request.blobs) {
+    options.blobs = request.blobs->fds();
+  }
+  if (request.inline_code) {
+    options.code_fd = request.inline_code->fd();
+  }
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    options.max_output_bytes = config_.max_output_bytes;
+  }
+  auto job = pool->Submit(request.file_execution_path, options,
+                          [this, on_output = request.on_output, blobs = request.blobs,
+                           inline_code = request.inline_code,
+                           callback = std::move(callback)](bool done, Json::Value&& result) {
+    Json::Value json_resp;
+    Json::Value status_resp;
+    // A failing script still reports what it imported and wrote, and returns
+    // the blobs it set
+    AddImportProfile(result, json_resp);
+    if (blobs) {
+      blobs->AddOutputs(json_resp);
+    }
+    for (const char* name : {"stdout", "stdout_truncated", "stderr", "stderr_truncated"}) {
+      if (result.isMember(name)) {
+        json_resp[name] = std::move(result[name]);
+      }
+    }
+    // Subinterpreters only hand their output over once they are done
+    if (on_output) {
+      for (std::string name : {"stdout", "stderr"}) {
+        if (json_resp.isMember(name) && json_resp[name].asString() != "") {
+          Json::Value output;
+          output["stream"] = name;
+          output["data"] = std::move(json_resp[name]);
+          on_output(std::move(output));
+        }
+        if (json_resp.get(name + "_truncated", false).asBool()) {
+          Json::Value output;
+          output["stream"] = name;
+          output["truncated"] = true;
+          on_output(std::move(output));
+        }
+        json_resp.removeMember(name);
+        json_resp.removeMember(name + "_truncated");
+      }
+    }
+    if (done) {
+      json_resp["message"] = "Executing the Python file";
+      status_resp["status_code"] = k200OK;
+    } else {
+      json_resp["message"] = "Failed to execute the Python file";
+      status_resp["status_code"] = k500InternalServerError;
+    }
+    callback(std::move(status_resp), std::move(json_resp));
+  });
+  // No process to signal, the script gets a TimeoutError instead
+  if (timeout) {
+    timeout->ArmInterrupt(GetReactor(), [job] { PythonSubinterpreterPool::Interrupt(job); });
+  }
+}
+
+std::string PythonEngine::GetChildProcessExePath() {
+  std::call_once(child_process_exe_path_once_, [this] {
+    // The runner is installed next to the engine library
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(&get_engine), &info) && info.dli_fname) {
+      char engine_path[PATH_MAX];
+      std::string engine_dir = python_utils::GetDirectoryPathFromFilePath(
+          realpath(info.dli_fname, engine_path) ? engine_path : info.dli_fname);
+      std::string runner_path = engine_dir + kRunnerExeName;
+      if (access(runner_path.c_str(), X_OK) == 0) {
+        child_process_exe_path_ = runner_path;
+        child_default_python_library_path_ = engine_dir + "python/";
+        LOG_INFO << "Running Python in child processes of " << runner_path;
+        return;
+      }
+    }
+    LOG_WARN << "No " << kRunnerExeName << " next to the engine, running Python in child processes of the server binary";
+    child_process_exe_path_ = python_utils::getCurrentExecutablePath();
+    child_default_python_library_path_ = python_utils::GetDefaultPythonLibraryPath(child_process_exe_path_);
+  });
+  return child_process_exe_path_;
+}
+
+python_worker::PythonRuntimeArgs PythonEngine::GetChildRuntimeArgs(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  GetChildProcessExePath();
+  python_worker::PythonRuntimeArgs runtime;
+  runtime.python_library_path = request.python_library_path;
+  runtime.python_dynamic_lib_path = python_utils::PythonRuntimeRegistry::Instance().FindPythonDynamicLib(
+      request.python_library_path != "" ? request.python_library_path : child_default_python_library_path_);
+  // A profile removed since the request was validated falls back to the defaults
+  std::lock_guard<std::mutex> l(mtx_);
+  auto it = config_.startup_profiles.find(request.startup_profile);
+  if (it != config_.startup_profiles.end()) {
+    runtime.startup_profile = it->second;
+  }
+  runtime.bytecode_cache_dir = config_.bytecode_cache_dir;
+  runtime.fast_exit = config_.fast_exit;
+  return runtime;
+}
+
+process_spawn::SpawnStrategy PythonEngine::GetSpawnStrategy() {
+  std::lock_guard<std::mutex> l(mtx_);
+  return SpawnStrategyFromConfig();
+}
+
+process_spawn::SpawnStrategy PythonEngine::SpawnStrategyFromConfig() const {
+  // The config only ever holds validated names
+  auto strategy = process_spawn::SpawnStrategy::kPosixSpawn;
+  process_spawn::ParseSpawnStrategy(config_.spawn_strategy, strategy);
+  return strategy;
+}
+
+#if defined(__linux__)
+bool PythonEngine::CreateExecutionCgroup(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+    std::shared_ptr<cgroup::CgroupManager>& cgroup_manager,
+    std::string& cgroup_path) {
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (!cgroup_manager_ || cgroup_manager_->root_path() != config_.cgroup_root) {
+      cgroup_manager_ = std::make_shared<cgroup::CgroupManager>(config_.cgroup_root);
+    }
+    cgroup_manager = cgroup_manager_;
+  }
+  if (!cgroup_manager->CreateLeaf(request.cpu_quota, request.memory_limit_mb,
+                                  request.pids_max, cgroup_path)) {
+    cgroup_manager.reset();
+    return false;
+  }
+  return true;
+}
+#endif
+
+std::string PythonEngine::ChildRuntimeKey(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  return request.python_library_path + '\n' + request.startup_profile;
+}
+
+std::shared_ptr<PythonOutputCapture> PythonEngine::CreateOutputCapture(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  size_t max_output_bytes;
+  {
+    std::lock_guard<std::mutex> l(mtx_);
+    max_output_bytes = config_.max_output_bytes;
+  }
+  return PythonOutputCapture::Create(GetReactor(), max_output_bytes, request.on_output);
+}
+
+ChildProcessReactor& PythonEngine::GetReactor() {
+  std::lock_guard<std::mutex> l(mtx_);
+  if (!reactor_) {
+    reactor_ = std::make_unique<ChildProcessReactor>();
+  }
+  return *reactor_;
+}
+
+std::shared_ptr<PythonWorkerPool> PythonEngine::GetWorkerPool(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  auto& reactor = GetReactor();
+  auto runtime = GetChildRuntimeArgs(request);
+  std::lock_guard<std::mutex> l(mtx_);
+  auto& pool = worker_pools_[ChildRuntimeKey(request)];
+  if (!pool) {
+    pool = std::make_shared<PythonWorkerPool>(
+        GetChildProcessExePath(), std::move(runtime),
+        config_.worker_pool_size, config_.max_jobs_per_worker,
+        SpawnStrategyFromConfig(), reactor);
+  }
+  return pool;
+}
+
+std::shared_ptr<PythonForkServer> PythonEngine::GetForkServer(
+    const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request) {
+  auto& reactor = GetReactor();
+  auto runtime = GetChildRuntimeArgs(request);
+  std::lock_guard<std::mutex> l(mtx_);
+  auto& fork_server = fork_servers_[ChildRuntimeKey(request)];
+  if (!fork_server) {
+    fork_server = std::make_shared<PythonForkServer>(
+        GetChildProcessExePath(), std::move(runtime),
+        config_.preload_modules, SpawnStrategyFromConfig(), reactor);
+  }
+  return fork_server;
+}
+
+std::shared_ptr<PythonSubinterpreterPool> PythonEngine::GetSubinterpreterPool(
+    const std::string& python_library_path) {
+  std::lock_guard<std::mutex> l(mtx_);
+  auto& pool = subinterpreter_pools_[python_library_path];
+  if (!pool) {
+    auto new_pool = std::make_shared<PythonSubinterpreterPool>(
+        python_utils::GetDefaultPythonLibraryPath(python_utils::getCurrentExecutablePath()),
+        python_library_path, config_.worker_pool_size, config_.max_jobs_per_worker,
+        config_.bytecode_cache_dir);
+    if (!new_pool->Start()) {
+      subinterpreter_pools_.erase(python_library_path);
+      return nullptr;
+    }
+    pool = std::move(new_pool);
+  }
+  return pool;
+}
+#endif
 
 extern "C" {
 CortexPythonEngineI* get_engine() {
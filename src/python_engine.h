@@ -1,13 +1,30 @@
 #pragma once
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "base/cortex-common/cortexpythoni.h"
 #include "json/forwards.h"
+#include "src/cgroup_manager.h"
+#include "src/child_process_reactor.h"
+#include "src/python_admission_queue.h"
+#include "src/python_engine_config.h"
+#include "src/python_execution_timeout.h"
 #include "src/python_file_execution_request.h"
+#include "src/python_fork_server.h"
+#include "src/python_import_profile.h"
+#include "src/python_inline_code.h"
+#include "src/python_output_capture.h"
+#include "src/python_shared_blobs.h"
+#include "src/python_job_table.h"
+#include "src/python_subinterpreter_pool.h"
+#include "src/python_worker_pool.h"
 
 class PythonEngine : public CortexPythonEngineI {
  public: 
+  PythonEngine();
   ~PythonEngine() final;
 
   void ExecutePythonFile(
@@ -18,10 +35,161 @@ class PythonEngine : public CortexPythonEngineI {
   void HandlePythonFileExecutionRequest(
       std::shared_ptr<Json::Value> jsonBody,
       std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
+
+  bool HandlePythonFileStreamingRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::function<void(Json::Value&&)>&& on_output,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
+
+  void HandlePythonTableExecutionRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::vector<CortexArrowTable>&& tables,
+      std::function<void(Json::Value&&, Json::Value&&, std::vector<CortexArrowTable>&&)>&& callback) final;
+
+  void HandleJobStatusRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
+
+  void HandleJobResultRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
+
+  int RunPythonWorker(
+      std::string binary_exec_path,
+      std::string pythonLibraryPath) final;
+
+  int RunPythonForkServer(
+      std::string binary_exec_path,
+      std::string pythonLibraryPath) final;
+
+  int RunPythonChildProcess(
+      std::string binary_exec_path,
+      int argc,
+      char** argv) final;
+
+  void HandleEngineConfigRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
+
+  void HandleEngineStatsRequest(
+      std::shared_ptr<Json::Value> jsonBody,
+      std::function<void(Json::Value&&, Json::Value&&)>&& callback) final;
   
  private:
-  void HandlePythonFileExecutionRequestImpl(
+  // Receives the status and the response of an execution
+  using ExecutionCallback = std::function<void(Json::Value&&, Json::Value&&)>;
+
+  // Returns false when the request is rejected before it runs, `callback`
+  // got the error then
+  bool HandlePythonFileExecutionRequestImpl(
       PythonRuntime::PythonFileExecution::PythonFileExecutionRequest&& request,
       std::function<void(Json::Value&&, Json::Value&&)> && callback);
 
+  // Starts the request with its resolved execution mode, or queues it while
+  // too many executions run. `callback` is called once it is done, usually
+  // from the reactor thread. Returns false, without calling `callback`, when
+  // the queue is full.
+  bool RunPythonFileExecution(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      ExecutionCallback&& callback);
+
+  void StartPythonFileExecution(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      ExecutionCallback&& callback);
+
+  // Answers with 429 and a hint of when to retry
+  void RejectPythonFileExecution(ExecutionCallback&& callback);
+
+  // Moves the profiled imports of a child `result`, if any, to the response
+  // and adds them to the engine stats
+  void AddImportProfile(Json::Value& result, Json::Value& json_resp);
+
+  // Returns why the resource limits of `request` cannot be applied, or an
+  // empty string
+  std::string ValidateResourceLimits(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+
+  void SpawnPythonFileExecution(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      std::shared_ptr<PythonExecutionTimeout> timeout,
+      ExecutionCallback&& callback);
+
+#if !defined(_WIN32)
+  void RunOnWorkerPool(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      std::shared_ptr<PythonExecutionTimeout> timeout,
+      ExecutionCallback&& callback);
+
+  void RunOnForkServer(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      std::shared_ptr<PythonExecutionTimeout> timeout,
+      ExecutionCallback&& callback);
+
+  void RunOnSubinterpreterPool(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      std::shared_ptr<PythonExecutionTimeout> timeout,
+      ExecutionCallback&& callback);
+
+  // Binary spawned for child processes: cortex-python-runner when it is
+  // installed next to the engine, the current executable otherwise
+  std::string GetChildProcessExePath();
+  // Runtime a child process starts for `request`, with its shared library
+  // resolved when it is found
+  python_worker::PythonRuntimeArgs GetChildRuntimeArgs(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+  // Pools are shared by the executions of one library path and startup profile
+  static std::string ChildRuntimeKey(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+  process_spawn::SpawnStrategy GetSpawnStrategy();
+  // Called with `mtx_` held
+  process_spawn::SpawnStrategy SpawnStrategyFromConfig() const;
+#if defined(__linux__)
+  // Creates the cgroup leaf limiting the resources of `request`
+  bool CreateExecutionCgroup(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request,
+      std::shared_ptr<cgroup::CgroupManager>& cgroup_manager,
+      std::string& cgroup_path);
+#endif
+  ChildProcessReactor& GetReactor();
+  // Pipes for the output of `request`, nullptr when they cannot be created
+  std::shared_ptr<PythonOutputCapture> CreateOutputCapture(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+  std::shared_ptr<PythonWorkerPool> GetWorkerPool(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+  std::shared_ptr<PythonForkServer> GetForkServer(
+      const PythonRuntime::PythonFileExecution::PythonFileExecutionRequest& request);
+  // nullptr when the runtime cannot host subinterpreters
+  std::shared_ptr<PythonSubinterpreterPool> GetSubinterpreterPool(const std::string& python_library_path);
+#endif
+
+  std::mutex mtx_;
+  PythonRuntime::EngineConfig::PythonEngineConfig config_;
+
+  PythonRuntime::PythonJobs::PythonJobTable job_table_;
+  PythonRuntime::ImportProfile::ImportStats import_stats_;
+  PythonRuntime::Admission::AdmissionQueue admission_queue_;
+  // Queued executions start there once admitted, never on the thread which
+  // finished the execution freeing their slot
+  PythonRuntime::Admission::StartDispatcher start_dispatcher_;
+  std::mutex executions_mtx_;
+  std::condition_variable executions_cond_;
+  size_t executions_in_flight_ = 0;
+#if !defined(_WIN32)
+  // Created on first use, so child processes running the engine do not start
+  // it. Declared before the pools which use it, so it is destroyed after them.
+  std::unique_ptr<ChildProcessReactor> reactor_;
+  std::once_flag child_process_exe_path_once_;
+  std::string child_process_exe_path_;
+  // Library directory child processes fall back to
+  std::string child_default_python_library_path_;
+  // One pool per Python library path and startup profile, created on first use
+  std::unordered_map<std::string, std::shared_ptr<PythonWorkerPool>> worker_pools_;
+  std::unordered_map<std::string, std::shared_ptr<PythonForkServer>> fork_servers_;
+  // Subinterpreters share the runtime of the server, whatever the startup profile
+  std::unordered_map<std::string, std::shared_ptr<PythonSubinterpreterPool>> subinterpreter_pools_;
+#endif
+#if defined(__linux__)
+  // Replaced when the cgroup root changes, executions keep their own
+  std::shared_ptr<cgroup::CgroupManager> cgroup_manager_;
+#endif
 };
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "json/value.h"
+#include "src/process_spawn.h"
+#include "src/python_startup_profile.h"
+
+namespace PythonRuntime::EngineConfig {
+
+// Child process per request, the interpreter boots for every execution
+constexpr const char* kExecutionModeSpawn = "spawn";
+// Warm worker processes which keep their interpreter between executions
+constexpr const char* kExecutionModeWorkerPool = "worker_pool";
+// Zygote process with preloaded modules forking a child per execution
+constexpr const char* kExecutionModeForkServer = "fork_server";
+// Threads of the server running subinterpreters with their own GIL
+constexpr const char* kExecutionModeSubinterpreter = "subinterpreter";
+
+// Upper bound of `worker_pool_size`, each worker is a process or thread
+// holding its own interpreter
+constexpr const int kMaxWorkerPoolSize = 256;
+
+// Startup profile of executions which do not pick one
+constexpr const char* kStartupProfileDefault = "default";
+// Skips site processing and the environment, for self-contained scripts
+constexpr const char* kStartupProfileFast = "fast";
+
+inline std::map<std::string, python_utils::PythonStartupProfile> DefaultStartupProfiles() {
+  python_utils::PythonStartupProfile fast;
+  fast.no_site = true;
+  fast.isolated = true;
+  return {{kStartupProfileDefault, {}}, {kStartupProfileFast, fast}};
+}
+
+// One interpreter per core, more only compete for the same CPUs
+inline int DefaultMaxConcurrentExecutions() {
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+struct PythonEngineConfig {
+  std::string execution_mode = kExecutionModeSpawn;
+  int worker_pool_size = 4;
+  // Workers are restarted after this many jobs, 0 keeps them forever
+  int max_jobs_per_worker = 0;
+  // Modules the fork server imports before forking children
+  std::vector<std::string> preload_modules;
+  // How child, worker and fork server processes are created
+  std::string spawn_strategy = "posix_spawn";
+  // Delegated cgroup v2 subtree holding executions with resource limits,
+  // resource limits are rejected while it is empty
+  std::string cgroup_root = "";
+  // Executions running at once, 0 means no limit
+  int max_concurrent_executions = DefaultMaxConcurrentExecutions();
+  // Executions waiting for a slot, beyond that requests are rejected
+  int max_queued_executions = 256;
+  // Share of the execution slots of each tenant, 1 for unlisted tenants
+  std::map<std::string, double> tenant_weights;
+  // Wall-clock limit of executions without their own, 0 means none
+  int64_t default_timeout_ms = 0;
+  // Time between SIGTERM and SIGKILL once an execution timed out
+  int64_t timeout_grace_period_ms = 5000;
+  // Interpreter options of child processes, by name
+  std::string startup_profile = kStartupProfileDefault;
+  std::map<std::string, python_utils::PythonStartupProfile> startup_profiles = DefaultStartupProfiles();
+  // Compiled code of executed scripts, by content hash. Empty disables the
+  // cache and every execution compiles its script.
+  std::string bytecode_cache_dir = "";
+  // Children running a single execution (spawn and fork_server modes) exit
+  // right after atexit handlers instead of finalizing the interpreter
+  bool fast_exit = false;
+  // Output kept of each of stdout and stderr of executions capturing it,
+  // the rest is dropped
+  int64_t max_output_bytes = 1024 * 1024;
+};
+
+inline bool IsValidExecutionMode(const std::string& execution_mode) {
+  return execution_mode == kExecutionModeSpawn ||
+         execution_mode == kExecutionModeWorkerPool ||
+         execution_mode == kExecutionModeForkServer ||
+         execution_mode == kExecutionModeSubinterpreter;
+}
+
+inline bool IsValidSpawnStrategy(const std::string& spawn_strategy) {
+#if defined(_WIN32)
+  return spawn_strategy == "posix_spawn";
+#else
+  process_spawn::SpawnStrategy strategy;
+  return process_spawn::ParseSpawnStrategy(spawn_strategy, strategy);
+#endif
+}
+
+inline python_utils::PythonStartupProfile StartupProfileFromJson(const Json::Value& json) {
+  python_utils::PythonStartupProfile profile;
+  profile.no_site = json.get("no_site", profile.no_site).asBool();
+  profile.isolated = json.get("isolated", profile.isolated).asBool();
+  profile.optimize = json.get("optimize", profile.optimize).asInt();
+  profile.dont_write_bytecode = json.get("dont_write_bytecode", profile.dont_write_bytecode).asBool();
+  profile.hash_seed = json.get("hash_seed", Json::Int64(profile.hash_seed)).asInt64();
+  profile.packed_stdlib = json.get("packed_stdlib", profile.packed_stdlib).asBool();
+  profile.allocator = json.get("allocator", profile.allocator).asString();
+  return profile;
+}
+
+inline PythonEngineConfig FromJson(std::shared_ptr<Json::Value> json_body,
+                                   const PythonEngineConfig& current = {}) {
+  PythonEngineConfig config = current;
+
+  if (json_body) {
+    config.execution_mode = json_body->get("execution_mode", config.execution_mode).asString();
+    config.worker_pool_size = json_body->get("worker_pool_size", config.worker_pool_size).asInt();
+    config.max_jobs_per_worker = json_body->get("max_jobs_per_worker", config.max_jobs_per_worker).asInt();
+    config.spawn_strategy = json_body->get("spawn_strategy", config.spawn_strategy).asString();
+    config.cgroup_root = json_body->get("cgroup_root", config.cgroup_root).asString();
+    config.max_concurrent_executions =
+        json_body->get("max_concurrent_executions", config.max_concurrent_executions).asInt();
+    config.max_queued_executions =
+        json_body->get("max_queued_executions", config.max_queued_executions).asInt();
+    config.default_timeout_ms =
+        json_body->get("default_timeout_ms", config.default_timeout_ms).asInt64();
+    config.timeout_grace_period_ms =
+        json_body->get("timeout_grace_period_ms", config.timeout_grace_period_ms).asInt64();
+    if (json_body->isMember("tenant_weights")) {
+      const auto& tenant_weights = (*json_body)["tenant_weights"];
+      config.tenant_weights.clear();
+      for (const auto& tenant : tenant_weights.getMemberNames()) {
+        config.tenant_weights[tenant] = tenant_weights[tenant].asDouble();
+      }
+    }
+    config.startup_profile = json_body->get("startup_profile", config.startup_profile).asString();
+    config.bytecode_cache_dir = json_body->get("bytecode_cache_dir", config.bytecode_cache_dir).asString();
+    config.fast_exit = json_body->get("fast_exit", config.fast_exit).asBool();
+    config.max_output_bytes = json_body->get("max_output_bytes", Json::Int64(config.max_output_bytes)).asInt64();
+    // Listed profiles are added or replaced, the others are kept
+    if (json_body->isMember("startup_profiles")) {
+      const auto& startup_profiles = (*json_body)["startup_profiles"];
+      for (const auto& name : startup_profiles.getMemberNames()) {
+        config.startup_profiles[name] = StartupProfileFromJson(startup_profiles[name]);
+      }
+    }
+    if (json_body->isMember("preload_modules")) {
+      config.preload_modules.clear();
+      for (const auto& module : (*json_body)["preload_modules"]) {
+        config.preload_modules.push_back(module.asString());
+      }
+    }
+  }
+
+  return config;
+}
+
+} // namespace PythonRuntime::EngineConfig
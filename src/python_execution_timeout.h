@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <sys/types.h>
+
+#include "src/child_process_reactor.h"
+#include "trantor/utils/Logger.h"
+#endif
+
+// Wall-clock bound of one execution. Once armed with the process group
+// running the script, the group gets SIGTERM at the deadline, then SIGKILL
+// if it is still around after the grace period. Shared by the execution and
+// the reactor timers enforcing it.
+class PythonExecutionTimeout : public std::enable_shared_from_this<PythonExecutionTimeout> {
+ public:
+  PythonExecutionTimeout(std::chrono::steady_clock::time_point deadline,
+                         std::chrono::milliseconds grace_period)
+      : deadline_(deadline), grace_period_(grace_period) {}
+
+  std::chrono::steady_clock::time_point deadline() const { return deadline_; }
+
+#if !defined(_WIN32)
+  // The timers run on the reactor thread, like the handlers which finish
+  // executions, so a group is never signalled once its execution is done
+  void Arm(ChildProcessReactor& reactor, pid_t process_group) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (done_) {
+      return;
+    }
+    reactor_ = &reactor;
+    timers_.push_back(reactor.RunAt(deadline_, [self = shared_from_this(), process_group] {
+      self->Terminate(process_group);
+    }));
+  }
+
+  // For executions without a process of their own, `interrupt` is called
+  // once at the deadline and has to stop the execution by itself
+  void ArmInterrupt(ChildProcessReactor& reactor, std::function<void()> interrupt) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (done_) {
+      return;
+    }
+    reactor_ = &reactor;
+    timers_.push_back(reactor.RunAt(deadline_, [self = shared_from_this(),
+                                                interrupt = std::move(interrupt)] {
+      {
+        std::lock_guard<std::mutex> l(self->mtx_);
+        if (self->done_) {
+          return;
+        }
+        LOG_WARN << "Python execution timed out, interrupting it";
+        self->timed_out_ = true;
+      }
+      interrupt();
+    }));
+  }
+#endif
+
+  // For executions which enforce the deadline themselves
+  void MarkTimedOut() {
+    std::lock_guard<std::mutex> l(mtx_);
+    timed_out_ = true;
+  }
+
+  // Stops enforcing the deadline, returns whether the execution outlived it
+  bool Finish() {
+    std::lock_guard<std::mutex> l(mtx_);
+    done_ = true;
+#if !defined(_WIN32)
+    for (auto id : timers_) {
+      reactor_->CancelTimer(id);
+    }
+    timers_.clear();
+#endif
+    return timed_out_;
+  }
+
+ private:
+#if !defined(_WIN32)
+  void Terminate(pid_t process_group) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (done_) {
+      return;
+    }
+    LOG_WARN << "Python execution " << process_group << " timed out, terminating it";
+    timed_out_ = true;
+    kill(-process_group, SIGTERM);
+    timers_.push_back(reactor_->RunAt(std::chrono::steady_clock::now() + grace_period_,
+                                      [self = shared_from_this(), process_group] {
+                                        self->Kill(process_group);
+                                      }));
+  }
+
+  void Kill(pid_t process_group) {
+    std::lock_guard<std::mutex> l(mtx_);
+    if (done_) {
+      return;
+    }
+    LOG_WARN << "Python execution " << process_group << " ignored SIGTERM, killing it";
+    kill(-process_group, SIGKILL);
+  }
+#endif
+
+  std::chrono::steady_clock::time_point deadline_;
+  std::chrono::milliseconds grace_period_;
+
+  std::mutex mtx_;
+  bool done_ = false;
+  bool timed_out_ = false;
+#if !defined(_WIN32)
+  ChildProcessReactor* reactor_ = nullptr;
+  std::vector<ChildProcessReactor::TimerId> timers_;
+#endif
+};
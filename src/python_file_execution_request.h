@@ -1,16 +1,72 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "base/cortex-common/cortex_arrow.h"
 #include "json/value.h"
 
+// Shared memory of the blobs of an execution, see python_shared_blobs.h
+class PythonSharedBlobs;
+// Inline source of an execution, see python_inline_code.h
+class PythonInlineCode;
+
 namespace PythonRuntime::PythonFileExecution {
 
 struct PythonFileExecutionRequest {
   std::string file_execution_path = "";
+  // Source run instead of a file, without it touching the disk
+  std::string code = "";
+  // Set by the engine once the code is in memory handed to the execution
+  std::shared_ptr<PythonInlineCode> inline_code;
   std::string python_library_path = "";
   bool isDefaultLib = true;
+  // Overrides the engine execution mode when not empty
+  std::string execution_mode = "";
+  // Return a job id right away instead of waiting for the execution
+  bool is_async = false;
+  // Resource limits of the execution, 0 means unlimited. The quota is a
+  // number of CPUs and may be fractional.
+  double cpu_quota = 0;
+  int64_t memory_limit_mb = 0;
+  int64_t pids_max = 0;
+  // Scheduling class (interactive, normal or batch) and tenant of the
+  // execution while it waits for a slot
+  std::string priority = "";
+  std::string tenant = "";
+  // Wall-clock limit of the execution, 0 uses the engine default
+  int64_t timeout_ms = 0;
+  // Named interpreter options, empty uses the engine default
+  std::string startup_profile = "";
+  // Return how long each module loaded by the script took to import
+  bool profile_imports = false;
+  // Return what the script wrote to stdout and stderr instead of leaving it
+  // on the output of the server
+  bool capture_output = false;
+  // Set for streaming executions, receives their captured output as it
+  // arrives
+  std::function<void(Json::Value&&)> on_output;
+  // Named blobs, base64 encoded, the script reads from shared memory. Points
+  // into the request body, so large inputs are not copied.
+  std::shared_ptr<const Json::Value> inputs;
+  // Let the script return named blobs through shared memory
+  bool outputs = false;
+  // Record batches of C++ callers the script reads from shared memory,
+  // released once copied there
+  std::shared_ptr<std::vector<CortexArrowTable>> tables;
+  // Receives the tables the script returns, when set
+  std::shared_ptr<std::vector<CortexArrowTable>> output_tables;
+  // Set by the engine once the blobs are in shared memory
+  std::shared_ptr<PythonSharedBlobs> blobs;
+
+  bool HasResourceLimits() const {
+    return cpu_quota != 0 || memory_limit_mb != 0 || pids_max != 0;
+  }
+
+  bool UsesSharedBlobs() const { return inputs || outputs || tables || output_tables || blobs; }
 };
 
 inline PythonFileExecutionRequest FromJson(std::shared_ptr<Json::Value> json_body) {
@@ -18,7 +74,23 @@ inline PythonFileExecutionRequest FromJson(std::shared_ptr<Json::Value> json_bod
 
   if (json_body) {
     request.file_execution_path = json_body->get("file_execution_path", "").asString();
+    request.code = json_body->get("code", "").asString();
     request.python_library_path = json_body->get("python_library_path", "").asString();
+    request.execution_mode = json_body->get("execution_mode", "").asString();
+    request.is_async = json_body->get("async", false).asBool();
+    request.cpu_quota = json_body->get("cpu_quota", 0).asDouble();
+    request.memory_limit_mb = json_body->get("memory_limit_mb", 0).asInt64();
+    request.pids_max = json_body->get("pids_max", 0).asInt64();
+    request.priority = json_body->get("priority", "").asString();
+    request.tenant = json_body->get("tenant", "").asString();
+    request.timeout_ms = json_body->get("timeout_ms", 0).asInt64();
+    request.startup_profile = json_body->get("startup_profile", "").asString();
+    request.profile_imports = json_body->get("profile_imports", false).asBool();
+    request.capture_output = json_body->get("capture_output", false).asBool();
+    if (json_body->isMember("inputs")) {
+      request.inputs = std::shared_ptr<const Json::Value>(json_body, &(*json_body)["inputs"]);
+    }
+    request.outputs = json_body->get("outputs", false).asBool();
   }
 
   return request;
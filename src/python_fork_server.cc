@@ -0,0 +1,133 @@
+#include "python_fork_server.h"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstring>
+#include <sys/wait.h>
+
+#include "trantor/utils/Logger.h"
+
+PythonForkServer::PythonForkServer(std::string zygote_exe_path,
+                                   python_worker::PythonRuntimeArgs runtime,
+                                   std::vector<std::string> preload_modules,
+                                   process_spawn::SpawnStrategy spawn_strategy,
+                                   ChildProcessReactor& reactor)
+    : zygote_exe_path_(std::move(zygote_exe_path)),
+      runtime_(std::move(runtime)),
+      preload_modules_(std::move(preload_modules)),
+      spawn_strategy_(spawn_strategy),
+      reactor_(reactor) {
+  // Start preloading right away so the zygote is warm by the first request
+  std::lock_guard<std::mutex> l(mtx_);
+  StartZygote();
+}
+
+PythonForkServer::~PythonForkServer() {
+  std::lock_guard<std::mutex> l(mtx_);
+  StopZygote();
+}
+
+pid_t PythonForkServer::Submit(const Json::Value& job, ResultCallback on_done,
+                               const std::vector<int>& fds) {
+  int channel_fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel_fds) != 0) {
+    LOG_ERROR << "Failed to create job channel: " << strerror(errno);
+    on_done(false, Json::Value());
+    return -1;
+  }
+  fcntl(channel_fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(channel_fds[1], F_SETFD, FD_CLOEXEC);
+
+  std::vector<int> job_fds = {channel_fds[1]};
+  job_fds.insert(job_fds.end(), fds.begin(), fds.end());
+  pid_t pid = Fork(job, job_fds);
+  close(channel_fds[1]);
+  if (pid <= 0) {
+    close(channel_fds[0]);
+    on_done(false, Json::Value());
+    return -1;
+  }
+  LOG_INFO << "Forked child " << pid << " for Python embedding";
+
+  // The child holds the only other end, EOF without a result means it crashed
+  auto job_channel = std::make_shared<python_worker::MessageChannel>(channel_fds[0]);
+  reactor_.WatchFd(channel_fds[0], [this, self = shared_from_this(), pid, job_channel,
+                            on_done = std::move(on_done)] {
+    bool open = job_channel->ReadAvailable();
+    Json::Value result;
+    bool answered = job_channel->PopMessage(result);
+    if (!answered && open) {
+      return;
+    }
+
+    reactor_.UnwatchFd(job_channel->fd());
+    if (!answered) {
+      LOG_ERROR << "Python child " << pid << " exited unexpectedly";
+    }
+    // The child waits for the channel to close before exiting, so whatever
+    // on_done signals is still the child
+    on_done(answered, std::move(result));
+    close(job_channel->fd());
+  });
+  return pid;
+}
+
+pid_t PythonForkServer::Fork(const Json::Value& job, const std::vector<int>& fds) {
+  std::lock_guard<std::mutex> l(mtx_);
+
+  // A zygote that died is restarted once, preloading again costs a cold start
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!channel_ && !StartZygote()) {
+      return -1;
+    }
+
+    Json::Value ack;
+    if (!ready_ && channel_->Receive(ack)) {
+      ready_ = true;
+    }
+    if (ready_ && channel_->Send(job, fds) && channel_->Receive(ack)) {
+      return ack.get("pid", -1).asInt();
+    }
+
+    LOG_WARN << "Python fork server " << zygote_pid_ << " is gone, restarting it";
+    StopZygote();
+  }
+  return -1;
+}
+
+bool PythonForkServer::StartZygote() {
+  std::vector<std::string> zygote_args = {"--run_python_zygote"};
+  runtime_.AppendTo(zygote_args);
+
+  int fd = python_worker::SpawnWithChannel(zygote_exe_path_, zygote_args, spawn_strategy_, zygote_pid_);
+  if (fd < 0) {
+    LOG_ERROR << "Failed to spawn Python fork server: " << strerror(errno);
+    return false;
+  }
+  channel_ = std::make_unique<python_worker::MessageChannel>(fd);
+
+  Json::Value init;
+  init["preload_modules"] = Json::Value(Json::arrayValue);
+  for (const auto& module : preload_modules_) {
+    init["preload_modules"].append(module);
+  }
+  if (!channel_->Send(init)) {
+    StopZygote();
+    return false;
+  }
+  LOG_INFO << "Started Python fork server " << zygote_pid_;
+  return true;
+}
+
+void PythonForkServer::StopZygote() {
+  if (!channel_) {
+    return;
+  }
+  // Closing the channel ends the zygote loop, forked children run on
+  close(channel_->fd());
+  channel_.reset();
+  ready_ = false;
+  waitpid(zygote_pid_, nullptr, 0);
+  zygote_pid_ = -1;
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "json/value.h"
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+
+#include "src/child_process_reactor.h"
+#include "src/python_worker_protocol.h"
+
+// Zygote process which boots the Python runtime of one library path and
+// startup profile, imports a list of heavy modules and freezes them, then
+// forks a child per job. Each execution keeps process isolation while
+// sharing the preloaded module pages copy-on-write.
+class PythonForkServer : public std::enable_shared_from_this<PythonForkServer> {
+ public:
+  // Receives whether the child ran the job, and its result
+  using ResultCallback = std::function<void(bool, Json::Value&&)>;
+
+  PythonForkServer(std::string zygote_exe_path,
+                   python_worker::PythonRuntimeArgs runtime,
+                   std::vector<std::string> preload_modules,
+                   process_spawn::SpawnStrategy spawn_strategy,
+                   ChildProcessReactor& reactor);
+  ~PythonForkServer();
+
+  // Forks a child for `job`, `on_done` is called from the reactor thread
+  // once the child reported back or died. A child which reported back only
+  // exits once `on_done` returned. `fds` are passed along with the job, after
+  // its result channel. Returns the pid of the child, or -1 when
+  // `on_done` was already called because no child could be forked.
+  pid_t Submit(const Json::Value& job, ResultCallback on_done, const std::vector<int>& fds = {});
+
+ private:
+  bool StartZygote();
+  void StopZygote();
+  // Hands the job to the zygote, returns the pid of the forked child
+  pid_t Fork(const Json::Value& job, const std::vector<int>& fds);
+
+  std::string zygote_exe_path_;
+  python_worker::PythonRuntimeArgs runtime_;
+  std::vector<std::string> preload_modules_;
+  process_spawn::SpawnStrategy spawn_strategy_;
+  ChildProcessReactor& reactor_;
+
+  // Serializes the jobs sent to the zygote, which answers them in order
+  std::mutex mtx_;
+  pid_t zygote_pid_ = -1;
+  std::unique_ptr<python_worker::MessageChannel> channel_;
+  // Whether the zygote acknowledged its init message and accepts jobs
+  bool ready_ = false;
+};
+#endif
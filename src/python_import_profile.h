@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "json/value.h"
+#include "src/python_utils.h"
+
+namespace PythonRuntime::ImportProfile {
+
+// Distinct modules aggregated at most, later ones are only counted as dropped
+constexpr const size_t kMaxProfiledModules = 10000;
+
+// How the modules loaded by an execution are reported, in load order
+inline Json::Value ToJson(const std::vector<python_utils::ModuleImportTime>& imports) {
+  Json::Value json(Json::arrayValue);
+  for (const auto& time : imports) {
+    Json::Value entry;
+    entry["module"] = time.module;
+    entry["self_us"] = Json::Int64(time.self_us);
+    entry["cumulative_us"] = Json::Int64(time.cumulative_us);
+    json.append(std::move(entry));
+  }
+  return json;
+}
+
+// Import costs of every profiled execution, per module, to tell which
+// imports dominate cold starts
+class ImportStats {
+ public:
+  // Adds the imports of one execution, as ToJson reports them
+  void Add(const Json::Value& imports) {
+    std::lock_guard<std::mutex> l(mtx_);
+    executions_++;
+    for (const auto& entry : imports) {
+      std::string module = entry.get("module", "").asString();
+      auto it = modules_.find(module);
+      if (it == modules_.end()) {
+        if (modules_.size() >= kMaxProfiledModules) {
+          dropped_++;
+          continue;
+        }
+        it = modules_.emplace(module, ModuleStats()).first;
+      }
+      int64_t cumulative_us = entry.get("cumulative_us", 0).asInt64();
+      it->second.count++;
+      it->second.self_us += entry.get("self_us", 0).asInt64();
+      it->second.cumulative_us += cumulative_us;
+      it->second.max_cumulative_us = std::max(it->second.max_cumulative_us, cumulative_us);
+    }
+  }
+
+  Json::Value ToJson() const {
+    std::lock_guard<std::mutex> l(mtx_);
+    Json::Value json;
+    json["executions"] = Json::UInt64(executions_);
+    json["dropped_imports"] = Json::UInt64(dropped_);
+    json["modules"] = Json::Value(Json::objectValue);
+    for (const auto& [module, stats] : modules_) {
+      Json::Value entry;
+      entry["count"] = Json::UInt64(stats.count);
+      entry["self_us"] = Json::Int64(stats.self_us);
+      entry["cumulative_us"] = Json::Int64(stats.cumulative_us);
+      entry["max_cumulative_us"] = Json::Int64(stats.max_cumulative_us);
+      json["modules"][module] = std::move(entry);
+    }
+    return json;
+  }
+
+ private:
+  // Totals over the executions which loaded the module
+  struct ModuleStats {
+    uint64_t count = 0;
+    int64_t self_us = 0;
+    int64_t cumulative_us = 0;
+    int64_t max_cumulative_us = 0;
+  };
+
+  mutable std::mutex mtx_;
+  uint64_t executions_ = 0;
+  uint64_t dropped_ = 0;
+  std::unordered_map<std::string, ModuleStats> modules_;
+};
+
+} // namespace PythonRuntime::ImportProfile
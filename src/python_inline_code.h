@@ -0,0 +1,58 @@
+#pragma once
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+#include "src/python_worker_protocol.h"
+
+// Source of an inline execution, in an anonymous memory file handed to
+// whatever runs it instead of a file on disk. Where memfd allows it the
+// file is sealed, so the mapping the script is compiled from can neither
+// change nor shrink.
+class PythonInlineCode {
+ public:
+  // nullptr with errno set when the memory cannot be created
+  static std::unique_ptr<PythonInlineCode> Create(const std::string& code) {
+    std::unique_ptr<PythonInlineCode> inline_code(new PythonInlineCode());
+    inline_code->fd_ = python_worker::CreateSharedMemoryFd("cortex-python-code", true);
+    if (inline_code->fd_ < 0) {
+      return nullptr;
+    }
+    size_t written = 0;
+    while (written < code.size()) {
+      ssize_t n = write(inline_code->fd_, code.data() + written, code.size() - written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return nullptr;
+      }
+      written += n;
+    }
+#if defined(__linux__)
+    fcntl(inline_code->fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return inline_code;
+  }
+
+  ~PythonInlineCode() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  PythonInlineCode(const PythonInlineCode&) = delete;
+  PythonInlineCode& operator=(const PythonInlineCode&) = delete;
+
+  int fd() const { return fd_; }
+
+ private:
+  PythonInlineCode() = default;
+
+  int fd_ = -1;
+};
+#endif
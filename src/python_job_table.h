@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "json/value.h"
+
+namespace PythonRuntime::PythonJobs {
+
+constexpr const char* kJobStateRunning = "running";
+constexpr const char* kJobStateFinished = "finished";
+
+// Executions submitted asynchronously, looked up by job id until they are
+// evicted. Finished jobs are kept for `retention` and at most
+// `max_finished_jobs` of them, oldest first.
+class PythonJobTable {
+ public:
+  PythonJobTable(std::chrono::seconds retention, size_t max_finished_jobs)
+      : retention_(retention), max_finished_jobs_(max_finished_jobs) {}
+
+  std::string Create() {
+    std::lock_guard<std::mutex> l(mtx_);
+    std::string id = NewId();
+    auto& job = jobs_[id];
+    job.submitted_at = std::chrono::system_clock::now();
+    return id;
+  }
+
+  void Finish(const std::string& id, Json::Value&& status, Json::Value&& result) {
+    std::lock_guard<std::mutex> l(mtx_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+      return;
+    }
+    it->second.finished = true;
+    it->second.finished_at = std::chrono::system_clock::now();
+    it->second.status = std::move(status);
+    it->second.result = std::move(result);
+    finished_order_.push_back(id);
+    Evict();
+  }
+
+  // Forgets a job which never started
+  void Remove(const std::string& id) {
+    std::lock_guard<std::mutex> l(mtx_);
+    jobs_.erase(id);
+  }
+
+  // Fills `out` with the state of the job, returns false for unknown ids
+  bool GetStatus(const std::string& id, Json::Value& out) {
+    std::lock_guard<std::mutex> l(mtx_);
+    Evict();
+    auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+      return false;
+    }
+    const auto& job = it->second;
+    out["job_id"] = id;
+    out["state"] = job.finished ? kJobStateFinished : kJobStateRunning;
+    out["submitted_at"] = ToUnixMillis(job.submitted_at);
+    if (job.finished) {
+      out["finished_at"] = ToUnixMillis(job.finished_at);
+      out["status_code"] = job.status["status_code"];
+    }
+    return true;
+  }
+
+  // Copies the outcome of a finished job, returns false while it is running
+  bool GetResult(const std::string& id, Json::Value& status, Json::Value& result) {
+    std::lock_guard<std::mutex> l(mtx_);
+    auto it = jobs_.find(id);
+    if (it == jobs_.end() || !it->second.finished) {
+      return false;
+    }
+    status = it->second.status;
+    result = it->second.result;
+    return true;
+  }
+
+ private:
+  struct Job {
+    bool finished = false;
+    std::chrono::system_clock::time_point submitted_at;
+    std::chrono::system_clock::time_point finished_at;
+    Json::Value status;
+    Json::Value result;
+  };
+
+  static Json::Int64 ToUnixMillis(std::chrono::system_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+  }
+
+  std::string NewId() {
+    std::ostringstream id;
+    id << std::hex << std::setfill('0') << std::setw(16) << rng_()
+       << std::setw(16) << rng_();
+    return id.str();
+  }
+
+  void Evict() {
+    auto now = std::chrono::system_clock::now();
+    while (!finished_order_.empty()) {
+      auto it = jobs_.find(finished_order_.front());
+      if (finished_order_.size() <= max_finished_jobs_ &&
+          now - it->second.finished_at < retention_) {
+        break;
+      }
+      jobs_.erase(it);
+      finished_order_.pop_front();
+    }
+  }
+
+  std::chrono::seconds retention_;
+  size_t max_finished_jobs_;
+
+  std::mutex mtx_;
+  std::mt19937_64 rng_{std::random_device{}()};
+  std::unordered_map<std::string, Job> jobs_;
+  // Finished job ids, oldest first
+  std::deque<std::string> finished_order_;
+};
+
+} // namespace PythonRuntime::PythonJobs
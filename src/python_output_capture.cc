@@ -0,0 +1,132 @@
+#include "python_output_capture.h"
+
+#if !defined(_WIN32)
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trantor/utils/Logger.h"
+
+std::shared_ptr<PythonOutputCapture> PythonOutputCapture::Create(ChildProcessReactor& reactor,
+                                                                 size_t max_bytes,
+                                                                 OutputCallback on_output) {
+  std::shared_ptr<PythonOutputCapture> capture(
+      new PythonOutputCapture(reactor, max_bytes, std::move(on_output)));
+  if (!capture->Open(capture->stdout_) || !capture->Open(capture->stderr_)) {
+    LOG_ERROR << "Failed to create output pipes: " << strerror(errno);
+    return nullptr;
+  }
+  capture->Watch(capture->stdout_);
+  capture->Watch(capture->stderr_);
+  return capture;
+}
+
+PythonOutputCapture::~PythonOutputCapture() {
+  Close(stdout_);
+  Close(stderr_);
+}
+
+bool PythonOutputCapture::Open(Stream& stream) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return false;
+  }
+  // Only the execution gets the write end, through its own duplicate
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  stream.read_fd = fds[0];
+  stream.write_fd = fds[1];
+  return true;
+}
+
+void PythonOutputCapture::Watch(Stream& stream) {
+  // The reactor holds the capture until Finish stops watching
+  reactor_.WatchFd(stream.read_fd, [self = shared_from_this(), &stream] {
+    std::lock_guard<std::mutex> l(self->mtx_);
+    if (!self->finished_) {
+      self->Drain(stream);
+    }
+  });
+}
+
+void PythonOutputCapture::Drain(Stream& stream) {
+  char chunk[16384];
+  while (true) {
+    ssize_t n = read(stream.read_fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      if (n == 0) {
+        // Every writer is gone, a closed pipe stays readable
+        reactor_.UnwatchFd(stream.read_fd);
+      }
+      return;
+    }
+    size_t room = stream.size < max_bytes_ ? max_bytes_ - stream.size : 0;
+    if (static_cast<size_t>(n) > room) {
+      stream.truncated = true;
+    }
+    size_t length = std::min(static_cast<size_t>(n), room);
+    stream.data.append(chunk, length);
+    stream.size += length;
+    if (on_output_) {
+      Forward(stream, false);
+    }
+  }
+}
+
+void PythonOutputCapture::Forward(Stream& stream, bool all) {
+  size_t length = all && !stream.truncated ? stream.data.size() : CompleteUtf8Length(stream.data);
+  if (length > 0) {
+    Json::Value output;
+    output["stream"] = stream.name;
+    output["data"] = stream.data.substr(0, length);
+    stream.data.erase(0, length);
+    on_output_(std::move(output));
+  }
+  if (stream.truncated && !stream.truncation_forwarded) {
+    // A character cut at the limit is dropped as well
+    stream.data.clear();
+    stream.truncation_forwarded = true;
+    Json::Value output;
+    output["stream"] = stream.name;
+    output["truncated"] = true;
+    on_output_(std::move(output));
+  }
+}
+
+void PythonOutputCapture::Close(Stream& stream) {
+  if (stream.read_fd >= 0) {
+    reactor_.UnwatchFd(stream.read_fd);
+    close(stream.read_fd);
+    stream.read_fd = -1;
+  }
+  if (stream.write_fd >= 0) {
+    close(stream.write_fd);
+    stream.write_fd = -1;
+  }
+}
+
+void PythonOutputCapture::Finish(Json::Value& json_resp) {
+  std::lock_guard<std::mutex> l(mtx_);
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  Drain(stdout_);
+  Drain(stderr_);
+  Close(stdout_);
+  Close(stderr_);
+  if (on_output_) {
+    Forward(stdout_, true);
+    Forward(stderr_, true);
+    return;
+  }
+  AddCapturedOutput(json_resp, "stdout", std::move(stdout_.data), stdout_.truncated);
+  AddCapturedOutput(json_resp, "stderr", std::move(stderr_.data), stderr_.truncated);
+}
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "json/value.h"
+
+// Length of `data` without a UTF-8 character cut at its end
+inline size_t CompleteUtf8Length(const std::string& data) {
+  // Start of the last character, past at most 3 continuation bytes
+  size_t lead = data.size();
+  while (lead > 0 && data.size() - lead < 3 && (static_cast<unsigned char>(data[lead - 1]) & 0xC0) == 0x80) {
+    lead--;
+  }
+  if (lead == 0) {
+    return data.size();
+  }
+  auto c = static_cast<unsigned char>(data[lead - 1]);
+  size_t length = (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+  return data.size() - (lead - 1) < length ? lead - 1 : data.size();
+}
+
+// Output of a stream kept at `max_bytes`, cut back to the last complete
+// UTF-8 character when it was truncated
+inline void AddCapturedOutput(Json::Value& json_resp, const std::string& name,
+                              std::string data, bool truncated) {
+  if (truncated) {
+    data.resize(CompleteUtf8Length(data));
+  }
+  json_resp[name] = std::move(data);
+  json_resp[name + "_truncated"] = truncated;
+}
+
+#if !defined(_WIN32)
+#include "src/child_process_reactor.h"
+
+// Standard output and error of one execution, read through pipes by the
+// reactor, at most `max_bytes` of each. Output beyond that is read and
+// dropped, so a chatty script never blocks on a full pipe.
+class PythonOutputCapture : public std::enable_shared_from_this<PythonOutputCapture> {
+ public:
+  // Receives {"stream", "data"} chunks of streamed output, in order, and a
+  // last {"stream", "truncated": true} one of a stream cut at `max_bytes`
+  using OutputCallback = std::function<void(Json::Value&&)>;
+
+  // nullptr when the pipes cannot be created. With `on_output` the output is
+  // passed on from the reactor thread as it arrives, ending at complete UTF-8
+  // characters, instead of being kept.
+  static std::shared_ptr<PythonOutputCapture> Create(ChildProcessReactor& reactor, size_t max_bytes,
+                                                     OutputCallback on_output = nullptr);
+  ~PythonOutputCapture();
+
+  PythonOutputCapture(const PythonOutputCapture&) = delete;
+  PythonOutputCapture& operator=(const PythonOutputCapture&) = delete;
+
+  // Write ends of the pipes, to become descriptors 1 and 2 of the execution.
+  // They stay open until Finish, whoever hands them over duplicates them.
+  int stdout_fd() const { return stdout_.write_fd; }
+  int stderr_fd() const { return stderr_.write_fd; }
+
+  // Reads what the execution wrote and is still in the pipes, stops reading
+  // and adds "stdout", "stderr" and their "_truncated" flags to `json_resp`,
+  // or passes the rest on when streaming. Output written after this, e.g. by
+  // processes the script left behind, is lost.
+  void Finish(Json::Value& json_resp);
+
+ private:
+  struct Stream {
+    explicit Stream(const char* name) : name(name) {}
+
+    const char* name;
+    int read_fd = -1;
+    int write_fd = -1;
+    std::string data;
+    // Bytes of the output kept so far, passed on ones included
+    size_t size = 0;
+    bool truncated = false;
+    bool truncation_forwarded = false;
+  };
+
+  PythonOutputCapture(ChildProcessReactor& reactor, size_t max_bytes, OutputCallback on_output)
+      : reactor_(reactor), max_bytes_(max_bytes), on_output_(std::move(on_output)) {}
+
+  bool Open(Stream& stream);
+  void Watch(Stream& stream);
+  // Reads `stream` until its pipe is empty, called with `mtx_` held
+  void Drain(Stream& stream);
+  // Passes the buffered output of `stream` on, all of it or up to its last
+  // complete character, then its truncation once it was cut
+  void Forward(Stream& stream, bool all);
+  void Close(Stream& stream);
+
+  ChildProcessReactor& reactor_;
+  size_t max_bytes_;
+  OutputCallback on_output_;
+
+  std::mutex mtx_;
+  Stream stdout_{"stdout"};
+  Stream stderr_{"stderr"};
+  bool finished_ = false;
+};
+#endif
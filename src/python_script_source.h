@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace python_utils {
+
+// Source of a script: a read-only mapping of its file, or a string already
+// held in memory. Either way it is NUL terminated, as the compiler expects,
+// and is compiled without being copied.
+class ScriptSource {
+ public:
+  ScriptSource() = default;
+  explicit ScriptSource(std::string source) : owned_(std::move(source)) {
+    data_ = owned_.c_str();
+    size_ = owned_.size();
+  }
+  ~ScriptSource() { Unmap(); }
+
+  ScriptSource(const ScriptSource&) = delete;
+  ScriptSource& operator=(const ScriptSource&) = delete;
+
+  // Maps the file at `path`, false when it cannot be read. The file must not
+  // shrink while it is mapped, reading past its new end faults the process.
+  bool MapFile(const std::string& path) {
+#if defined(_WIN32)
+    return ReadFile(path);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    bool mapped = MapFd(fd);
+    close(fd);
+    return mapped;
+#endif
+  }
+
+#if !defined(_WIN32)
+  // Maps the regular file open on `fd`, which stays owned by the caller and
+  // may be closed right after. The same care about shrinking applies.
+  bool MapFd(int fd) {
+    Unmap();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      return false;
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+      return true;
+    }
+
+    // The file is mapped over zeroed pages one byte longer than the file,
+    // the byte after its content is a NUL even for a page sized file
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (size + page_size) / page_size * page_size;
+    void* region = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+      return false;
+    }
+    if (mmap(region, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+      munmap(region, mapped_size);
+      return false;
+    }
+    mapping_ = region;
+    mapped_size_ = mapped_size;
+    data_ = static_cast<const char*>(region);
+    size_ = size;
+    return true;
+  }
+#endif
+
+  // Copies the file at `path`, for processes which must survive the file
+  // being rewritten while they read it
+  bool ReadFile(const std::string& path) {
+    Unmap();
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      return false;
+    }
+    owned_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data_ = owned_.c_str();
+    size_ = owned_.size();
+    return !file.bad();
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  // Returns why the source cannot be compiled, or an empty string. Sources
+  // without a coding declaration must be UTF-8.
+  std::string Validate() const {
+    if (memchr(data_, '\0', size_) != nullptr) {
+      return "source contains a NUL byte";
+    }
+    if (HasCodingDeclaration()) {
+      return "";
+    }
+    size_t pos = 0;
+    if (size_ >= 3 && memcmp(data_, "\xEF\xBB\xBF", 3) == 0) {
+      pos = 3;
+    }
+    while (pos < size_) {
+      auto c = static_cast<unsigned char>(data_[pos]);
+      size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+      if (length == 0 || pos + length > size_) {
+        return "invalid UTF-8 at byte " + std::to_string(pos);
+      }
+      for (size_t i = 1; i < length; i++) {
+        if ((static_cast<unsigned char>(data_[pos + i]) & 0xC0) != 0x80) {
+          return "invalid UTF-8 at byte " + std::to_string(pos);
+        }
+      }
+      pos += length;
+    }
+    return "";
+  }
+
+ private:
+  // A `coding[:=]` comment on one of the first two lines (PEP 263)
+  bool HasCodingDeclaration() const {
+    size_t line_start = 0;
+    for (int line = 0; line < 2 && line_start < size_; line++) {
+      const char* end = static_cast<const char*>(memchr(data_ + line_start, '\n', size_ - line_start));
+      size_t line_end = end ? end - data_ : size_;
+      std::string text(data_ + line_start, line_end - line_start);
+      size_t comment = text.find('#');
+      size_t coding = text.find("coding", comment == std::string::npos ? text.size() : comment);
+      if (coding != std::string::npos && coding + 6 < text.size() &&
+          (text[coding + 6] == ':' || text[coding + 6] == '=')) {
+        return true;
+      }
+      line_start = line_end + 1;
+    }
+    return false;
+  }
+
+  void Unmap() {
+#if !defined(_WIN32)
+    if (mapping_) {
+      munmap(mapping_, mapped_size_);
+      mapping_ = nullptr;
+    }
+#endif
+    owned_.clear();
+    data_ = "";
+    size_ = 0;
+  }
+
+  std::string owned_;
+  const char* data_ = "";
+  size_t size_ = 0;
+#if !defined(_WIN32)
+  void* mapping_ = nullptr;
+  size_t mapped_size_ = 0;
+#endif
+};
+
+} // namespace python_utils
@@ -0,0 +1,212 @@
+#pragma once
+
+#if !defined(_WIN32)
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "json/reader.h"
+#include "json/value.h"
+#include "json/writer.h"
+#include "src/base64.h"
+#include "src/python_arrow_tables.h"
+#include "src/python_utils.h"
+#include "src/python_worker_protocol.h"
+
+// Named input and output payloads of one execution, in memory shared with
+// the process running its script. Only the descriptors of the two regions
+// travel with the job, the script maps them and reads or writes the bytes in
+// place. Record batches of C++ callers travel the same way, column by column.
+// See python_utils::SharedBlobFds for their layout.
+class PythonSharedBlobs {
+ public:
+  // Input blobs start at this alignment, enough for any vectorized access
+  static constexpr size_t kInputAlignment = 64;
+
+  // Returns why `inputs` cannot be shared, or an empty string. They must map
+  // names to base64 encoded blobs.
+  static std::string ValidateInputs(const Json::Value& inputs) {
+    if (!inputs.isNull() && !inputs.isObject()) {
+      return "Inputs must map names to base64 encoded blobs";
+    }
+    for (const auto& name : inputs.getMemberNames()) {
+      if (!inputs[name].isString() || !python_utils::IsBase64(inputs[name].asString())) {
+        return "Input " + name + " is not base64 encoded";
+      }
+    }
+    return "";
+  }
+
+  // Returns why `tables` cannot be shared, or an empty string
+  static std::string ValidateTables(const std::vector<CortexArrowTable>& tables) {
+    std::set<std::string> names;
+    for (const auto& table : tables) {
+      if (!names.insert(table.name).second) {
+        return "Table " + table.name + " is not unique";
+      }
+      std::string error = python_utils::ValidateArrowTable(table);
+      if (error != "") {
+        return error;
+      }
+    }
+    return "";
+  }
+
+  // Regions holding the validated `inputs` and `tables`, nullptr with errno
+  // set when the memory cannot be created. The tables the script returns are
+  // added to `output_tables` by AddOutputs when it is set.
+  static std::unique_ptr<PythonSharedBlobs> Create(
+      const Json::Value& inputs, const std::vector<CortexArrowTable>& tables = {},
+      std::shared_ptr<std::vector<CortexArrowTable>> output_tables = nullptr) {
+    std::unique_ptr<PythonSharedBlobs> blobs(new PythonSharedBlobs());
+    blobs->output_tables_ = std::move(output_tables);
+    Json::Value table;
+    table["blobs"] = Json::Value(Json::objectValue);
+    table["tables"] = Json::Value(Json::objectValue);
+    size_t size = 0;
+    for (const auto& name : inputs.getMemberNames()) {
+      size_t length = python_utils::Base64DecodedSize(inputs[name].asString());
+      size = (size + kInputAlignment - 1) / kInputAlignment * kInputAlignment;
+      table["blobs"][name].append(Json::UInt64(size));
+      table["blobs"][name].append(Json::UInt64(length));
+      size += length;
+    }
+    for (const auto& input : tables) {
+      table["tables"][input.name] = python_utils::PlanArrowTable(input, kInputAlignment, size);
+    }
+    std::string trailer = TableTrailer(table);
+
+    blobs->input_fd_ = python_worker::CreateSharedMemoryFd("cortex-python-blobs");
+    blobs->output_fd_ = python_worker::CreateSharedMemoryFd("cortex-python-blobs", true);
+    if (blobs->input_fd_ < 0 || blobs->output_fd_ < 0 ||
+        ftruncate(blobs->input_fd_, size + trailer.size()) != 0) {
+      return nullptr;
+    }
+    // Decoded straight into the region, the payloads are not copied again
+    void* region = mmap(nullptr, size + trailer.size(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                        blobs->input_fd_, 0);
+    if (region == MAP_FAILED) {
+      return nullptr;
+    }
+    auto bytes = static_cast<char*>(region);
+    for (const auto& name : inputs.getMemberNames()) {
+      python_utils::Base64Decode(inputs[name].asString(), bytes + table["blobs"][name][0].asUInt64());
+    }
+    for (const auto& input : tables) {
+      python_utils::CopyArrowTable(input, table["tables"][input.name], bytes);
+    }
+    memcpy(bytes + size, trailer.data(), trailer.size());
+    munmap(region, size + trailer.size());
+    return blobs;
+  }
+
+  ~PythonSharedBlobs() {
+    if (input_fd_ >= 0) {
+      close(input_fd_);
+    }
+    if (output_fd_ >= 0) {
+      close(output_fd_);
+    }
+  }
+
+  PythonSharedBlobs(const PythonSharedBlobs&) = delete;
+  PythonSharedBlobs& operator=(const PythonSharedBlobs&) = delete;
+
+  python_utils::SharedBlobFds fds() const { return {input_fd_, output_fd_}; }
+
+  // Adds the blobs the script set, base64 encoded, as "outputs" to
+  // `json_resp`, and the tables it set to the output tables. Nothing is
+  // added when the script did not get to hand them over, e.g. because it
+  // crashed.
+  void AddOutputs(Json::Value& json_resp) const {
+#if defined(__linux__)
+    // Output tables keep pointing into the region, a process the script left
+    // behind must not cut it under them
+    fcntl(output_fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#endif
+    struct stat st;
+    if (fstat(output_fd_, &st) != 0 || st.st_size < 8) {
+      return;
+    }
+    size_t size = st.st_size;
+    void* region = mmap(nullptr, size, PROT_READ, MAP_SHARED, output_fd_, 0);
+    if (region == MAP_FAILED) {
+      LOG_ERROR << "Failed to map the output blobs: " << strerror(errno);
+      return;
+    }
+    // Shared by the output tables, whose buffers point into it
+    std::shared_ptr<const void> mapping(region, [size](const void* region) {
+      munmap(const_cast<void*>(region), size);
+    });
+    auto bytes = static_cast<const char*>(region);
+    Json::Value table;
+    uint64_t table_size = 0;
+    for (int i = 7; i >= 0; i--) {
+      table_size = (table_size << 8) | static_cast<unsigned char>(bytes[size - 8 + i]);
+    }
+    size_t data_size = size - 8 - std::min<uint64_t>(table_size, size - 8);
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    if (table_size > size - 8 ||
+        !reader->parse(bytes + data_size, bytes + size - 8, &table, nullptr) || !table.isObject() ||
+        !table["blobs"].isObject() || !table["tables"].isObject()) {
+      LOG_WARN << "Ignoring output blobs without a valid table";
+      return;
+    }
+
+    Json::Value outputs(Json::objectValue);
+    for (const auto& name : table["blobs"].getMemberNames()) {
+      const Json::Value& entry = table["blobs"][name];
+      uint64_t offset = entry.isArray() && entry.size() == 2 ? entry[0].asUInt64() : data_size;
+      uint64_t length = entry.isArray() && entry.size() == 2 ? entry[1].asUInt64() : 0;
+      if (offset > data_size || length > data_size - offset) {
+        LOG_WARN << "Ignoring output blob " << name << " outside of its region";
+        continue;
+      }
+      outputs[name] = python_utils::Base64Encode(bytes + offset, length);
+    }
+    json_resp["outputs"] = std::move(outputs);
+
+    if (!output_tables_) {
+      return;
+    }
+    for (const auto& name : table["tables"].getMemberNames()) {
+      CortexArrowTable output;
+      std::string error = python_utils::ImportArrowTable(mapping, data_size, name, table["tables"][name], output);
+      if (error != "") {
+        LOG_WARN << "Ignoring invalid output table: " << error;
+        continue;
+      }
+      output_tables_->push_back(std::move(output));
+    }
+  }
+
+ private:
+  PythonSharedBlobs() = default;
+
+  // JSON table of a region followed by its length
+  static std::string TableTrailer(const Json::Value& table) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string trailer = Json::writeString(builder, table);
+    uint64_t table_size = trailer.size();
+    for (int i = 0; i < 8; i++) {
+      trailer += static_cast<char>((table_size >> (8 * i)) & 0xFF);
+    }
+    return trailer;
+  }
+
+  int input_fd_ = -1;
+  int output_fd_ = -1;
+  std::shared_ptr<std::vector<CortexArrowTable>> output_tables_;
+};
+#endif
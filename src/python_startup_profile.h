@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "src/python_allocator.h"
+
+namespace python_utils {
+
+// Interpreter options a runtime starts with, the equivalent of the -S, -I,
+// -O/-OO and -B command line options and of PYTHONHASHSEED
+struct PythonStartupProfile {
+  bool no_site = false;
+  bool isolated = false;
+  int optimize = 0;
+  bool dont_write_bytecode = false;
+  // Seed of str and bytes hashes, -1 keeps them randomized
+  int64_t hash_seed = -1;
+  // Imports from the packed standard library of the default Python library,
+  // when it ships one
+  bool packed_stdlib = true;
+  // Memory allocator of the interpreter, empty keeps pymalloc
+  std::string allocator = "";
+
+  // Returns why the profile cannot be applied, or an empty string
+  std::string Validate() const {
+    if (optimize < 0 || optimize > 2) {
+      return "optimize must be 0, 1 or 2";
+    }
+    if (hash_seed < -1 || hash_seed > 4294967295LL) {
+      return "hash_seed must be between 0 and 4294967295";
+    }
+    if (!IsKnownAllocator(allocator)) {
+      return "allocator must be pymalloc, malloc or mimalloc";
+    }
+    return "";
+  }
+
+  // Command line options of the interpreter, the hash seed is set in its
+  // config instead
+  std::vector<std::string> InterpreterArgs() const {
+    std::vector<std::string> args;
+    if (no_site) args.push_back("-S");
+    if (isolated) args.push_back("-I");
+    if (optimize > 0) args.push_back(optimize > 1 ? "-OO" : "-O");
+    if (dont_write_bytecode) args.push_back("-B");
+    return args;
+  }
+
+  // How the profile is handed to child processes
+  std::vector<std::string> ToArgs() const {
+    std::vector<std::string> args = InterpreterArgs();
+    if (hash_seed >= 0) args.push_back("--hash-seed=" + std::to_string(hash_seed));
+    if (!packed_stdlib) args.push_back("--no-packed-stdlib");
+    if (allocator != "") args.push_back("--allocator=" + allocator);
+    return args;
+  }
+
+  // Applies one argument produced by ToArgs, false when it is not one
+  bool ParseArg(const std::string& arg) {
+    if (arg == "-S") no_site = true;
+    else if (arg == "-I") isolated = true;
+    else if (arg == "-O") optimize = 1;
+    else if (arg == "-OO") optimize = 2;
+    else if (arg == "-B") dont_write_bytecode = true;
+    else if (arg.rfind("--hash-seed=", 0) == 0) hash_seed = std::atoll(arg.c_str() + 12);
+    else if (arg == "--no-packed-stdlib") packed_stdlib = false;
+    else if (arg.rfind("--allocator=", 0) == 0) allocator = arg.substr(12);
+    else return false;
+    return true;
+  }
+};
+
+} // namespace python_utils
@@ -0,0 +1,299 @@
+#include "python_subinterpreter_pool.h"
+
+#if !defined(_WIN32)
+#include "src/python_import_profile.h"
+#include "src/python_output_capture.h"
+#include "trantor/utils/Logger.h"
+
+using namespace python_utils;
+
+namespace {
+
+constexpr const char* kReplaceOsExit =
+    "import os\n"
+    "def _exit(status):\n"
+    "    raise SystemExit(status)\n"
+    "os._exit = _exit\n"
+    "del _exit, os\n";
+
+// Runtime hosting the subinterpreters of every pool, a process can only
+// load one libpython
+struct InProcessRuntime {
+  std::mutex mtx;
+  bool loaded = false;
+  std::string python_library_path;
+  bool available = false;
+  PythonApi api;
+};
+
+InProcessRuntime g_runtime;
+
+// Returns the loaded runtime, or nullptr when it cannot host subinterpreters
+InProcessRuntime* LoadInProcessRuntime(const std::string& default_py_lib_path,
+                                       const std::string& py_lib_path) {
+  std::lock_guard<std::mutex> l(g_runtime.mtx);
+  if (g_runtime.loaded) {
+    if (g_runtime.python_library_path != py_lib_path) {
+      LOG_ERROR << "Subinterpreters run on the Python runtime of "
+                << (g_runtime.python_library_path == "" ? default_py_lib_path : g_runtime.python_library_path)
+                << " already loaded in the server";
+      return nullptr;
+    }
+    return g_runtime.available ? &g_runtime : nullptr;
+  }
+
+  // Failures are not retried either, they need a different runtime
+  g_runtime.loaded = true;
+  g_runtime.python_library_path = py_lib_path;
+  if (!InitializePythonRuntime(default_py_lib_path, py_lib_path, "", {}, g_runtime.api, false)) {
+    return nullptr;
+  }
+  if (!g_runtime.api.HasOwnGilSubinterpreters()) {
+    LOG_ERROR << "Subinterpreters with their own GIL need Python 3.12 or later";
+    FinalizePythonRuntime(g_runtime.api);
+    return nullptr;
+  }
+
+  // The main interpreter only creates subinterpreters, from any thread
+  g_runtime.api.PyEval_SaveThread();
+  g_runtime.available = true;
+  LOG_INFO << "Loaded the Python runtime hosting subinterpreters";
+  return &g_runtime;
+}
+
+} // namespace
+
+PythonSubinterpreterPool::PythonSubinterpreterPool(std::string default_python_library_path,
+                                                   std::string python_library_path,
+                                                   size_t pool_size,
+                                                   size_t max_jobs_per_interpreter,
+                                                   std::string bytecode_cache_dir)
+    : default_python_library_path_(std::move(default_python_library_path)),
+      python_library_path_(std::move(python_library_path)),
+      pool_size_(pool_size > 0 ? pool_size : 1),
+      max_jobs_per_interpreter_(max_jobs_per_interpreter),
+      bytecode_cache_dir_(std::move(bytecode_cache_dir)) {}
+
+PythonSubinterpreterPool::~PythonSubinterpreterPool() {
+  std::deque<std::shared_ptr<Job>> pending_jobs;
+  {
+    std::lock_guard<std::mutex> l(queue_->mtx);
+    queue_->running = false;
+    pending_jobs.swap(queue_->pending_jobs);
+  }
+  queue_->cond.notify_all();
+  for (auto& thread : threads_) {
+    // The last reference may be dropped by an execution started from one of
+    // the threads, that one ends on its own
+    if (thread.get_id() == std::this_thread::get_id()) {
+      thread.detach();
+    } else {
+      thread.join();
+    }
+  }
+  for (auto& job : pending_jobs) {
+    job->on_done(false, Json::Value());
+  }
+}
+
+bool PythonSubinterpreterPool::Start() {
+  auto* runtime = LoadInProcessRuntime(default_python_library_path_, python_library_path_);
+  if (!runtime) {
+    return false;
+  }
+  for (size_t i = 0; i < pool_size_; i++) {
+    threads_.emplace_back(Run, queue_, default_python_library_path_,
+                          python_library_path_ == "",
+                          max_jobs_per_interpreter_, bytecode_cache_dir_);
+  }
+  LOG_INFO << "Started " << pool_size_ << " Python subinterpreter threads";
+  return true;
+}
+
+std::shared_ptr<PythonSubinterpreterPool::Job> PythonSubinterpreterPool::Submit(
+    std::string file_execution_path, JobOptions options, ResultCallback on_done) {
+  auto job = std::make_shared<Job>();
+  job->file_execution_path = std::move(file_execution_path);
+  job->options = options;
+  job->on_done = std::move(on_done);
+  {
+    std::lock_guard<std::mutex> l(queue_->mtx);
+    queue_->pending_jobs.push_back(job);
+  }
+  queue_->cond.notify_one();
+  return job;
+}
+
+void PythonSubinterpreterPool::Interrupt(const std::shared_ptr<Job>& job) {
+  // Taking the GIL of a busy interpreter may take a while, not on the
+  // caller's thread. The runtime is never unloaded, unlike the pool.
+  const PythonApi& api = g_runtime.api;
+  std::thread([&api, job] {
+    PyInterpreterState* interpreter;
+    {
+      std::lock_guard<std::mutex> l(job->mtx);
+      if (job->finished) {
+        return;
+      }
+      if (!job->interpreter) {
+        // Not started yet, it will not be
+        job->finished = true;
+        return;
+      }
+      interpreter = job->interpreter;
+      job->interrupting = true;
+    }
+    // The job may finish while this waits for the GIL, it is checked again
+    // once it is held so that the exception cannot land past the script
+    PyThreadState* tstate = api.PyThreadState_New(interpreter);
+    api.PyEval_RestoreThread(tstate);
+    {
+      std::lock_guard<std::mutex> l(job->mtx);
+      if (!job->finished) {
+        api.PyThreadState_SetAsyncExc(job->thread_id, *api.PyExc_TimeoutError);
+      }
+    }
+    api.PyThreadState_Clear(tstate);
+    api.PyThreadState_DeleteCurrent();
+    {
+      std::lock_guard<std::mutex> l(job->mtx);
+      job->interrupting = false;
+    }
+    job->cond.notify_all();
+  }).detach();
+}
+
+void PythonSubinterpreterPool::Run(std::shared_ptr<JobQueue> queue,
+                                   std::string default_python_library_path,
+                                   bool is_default_python_lib,
+                                   size_t max_jobs_per_interpreter,
+                                   std::string bytecode_cache_dir) {
+  const PythonApi& api = g_runtime.api;
+
+  PyThreadState* main_tstate = nullptr;
+  PyThreadState* tstate = nullptr;
+  size_t jobs_done = 0;
+
+  auto end_interpreter = [&] {
+    api.PyEval_RestoreThread(tstate);
+    api.Py_EndInterpreter(tstate);
+    tstate = nullptr;
+    api.PyEval_RestoreThread(main_tstate);
+    api.PyThreadState_Clear(main_tstate);
+    api.PyThreadState_DeleteCurrent();
+    main_tstate = nullptr;
+  };
+
+  while (true) {
+    std::shared_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> l(queue->mtx);
+      queue->cond.wait(l, [&queue] { return !queue->running || !queue->pending_jobs.empty(); });
+      if (queue->pending_jobs.empty()) {
+        break;
+      }
+      job = std::move(queue->pending_jobs.front());
+      queue->pending_jobs.pop_front();
+    }
+
+    if (!tstate) {
+      // Subinterpreters are created from a thread state of the main one
+      main_tstate = api.PyThreadState_New(api.PyInterpreterState_Main());
+      api.PyEval_RestoreThread(main_tstate);
+      PyInterpreterConfig config = {};
+      config.allow_threads = 1;
+      config.check_multi_interp_extensions = 1;
+      config.gil = kPyInterpreterConfigOwnGil;
+      PyStatus status = api.Py_NewInterpreterFromConfig(&tstate, &config);
+      if (status.type != 0 || !tstate) {
+        LOG_ERROR << "Failed to create Python subinterpreter: "
+                  << (status.err_msg ? status.err_msg : "unknown error");
+        tstate = nullptr;
+        api.PyThreadState_Clear(main_tstate);
+        api.PyThreadState_DeleteCurrent();
+        main_tstate = nullptr;
+        job->on_done(false, Json::Value());
+        continue;
+      }
+      // The new interpreter starts from the config of the main one, not
+      // from its rerouted sys.path
+      if (is_default_python_lib) {
+        ClearAndSetPythonSysPath(default_python_library_path, api);
+      }
+      // Exiting would end the server, scripts only end themselves
+      api.PyRun_SimpleString(kReplaceOsExit);
+      api.PyEval_SaveThread();
+    }
+
+    {
+      std::lock_guard<std::mutex> l(job->mtx);
+      if (job->finished) {
+        // Interrupted while it was waiting
+        job->on_done(false, Json::Value());
+        continue;
+      }
+      job->interpreter = api.PyThreadState_GetInterpreter(tstate);
+      job->thread_id = api.PyThread_get_thread_ident();
+    }
+
+    // Files are copied rather than mapped, a script rewritten while it is
+    // read must not fault the server. Inline code is only reachable through
+    // the engine, it is mapped and never cached.
+    int rc = 1;
+    Json::Value result;
+    std::vector<ModuleImportTime> imports;
+    ScriptSource source;
+    const JobOptions& options = job->options;
+    bool inline_code = options.code_fd >= 0;
+    std::string script_name = inline_code ? kInlineCodeName : job->file_execution_path;
+    if (inline_code ? source.MapFd(options.code_fd) : source.ReadFile(job->file_execution_path)) {
+      api.PyEval_RestoreThread(tstate);
+      // The descriptors are shared with the server, only the Python streams
+      // of the interpreter are redirected
+      if (options.capture_output) {
+        StartOutputCapture(api, options.max_output_bytes);
+      }
+      rc = RunPythonSourceInFreshNamespace(api, script_name, source, inline_code ? "" : bytecode_cache_dir,
+                                           options.profile_imports ? &imports : nullptr, options.blobs);
+      {
+        // Interrupts only check this holding the GIL, none is raised after
+        std::lock_guard<std::mutex> l(job->mtx);
+        job->finished = true;
+      }
+      // Drops one which arrived as the script returned, before the cleanup
+      api.PyThreadState_SetAsyncExc(job->thread_id, nullptr);
+      CapturedOutput output;
+      if (options.capture_output) {
+        output = StopOutputCapture(api);
+      }
+      api.PyEval_SaveThread();
+      if (options.profile_imports) {
+        result["imports"] = PythonRuntime::ImportProfile::ToJson(imports);
+      }
+      if (options.capture_output) {
+        AddCapturedOutput(result, "stdout", std::move(output.stdout_data), output.stdout_truncated);
+        AddCapturedOutput(result, "stderr", std::move(output.stderr_data), output.stderr_truncated);
+      }
+    } else {
+      LOG_ERROR << "Failed to open file " << script_name;
+    }
+
+    {
+      // The interpreter may be ended below, wait for an interrupt using it
+      std::unique_lock<std::mutex> l(job->mtx);
+      job->finished = true;
+      job->cond.wait(l, [&job] { return !job->interrupting; });
+    }
+    job->on_done(rc == 0, std::move(result));
+
+    if (max_jobs_per_interpreter > 0 && ++jobs_done >= max_jobs_per_interpreter) {
+      end_interpreter();
+      jobs_done = 0;
+    }
+  }
+
+  if (tstate) {
+    end_interpreter();
+  }
+}
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include "json/value.h"
+#include "src/python_utils.h"
+
+// Threads of the server process, each running scripts in a subinterpreter
+// with its own GIL (Python 3.12+), so executions run in parallel without
+// spawning anything. The Python runtime is loaded into the server once, from
+// the first library path used, and stays loaded until the process exits.
+//
+// Scripts share the address space of the server: extension modules must
+// support subinterpreters, and a crashing script takes the server down.
+class PythonSubinterpreterPool {
+ public:
+  // Receives whether the script ran without error, and its "imports" and
+  // output when they were asked for
+  using ResultCallback = std::function<void(bool, Json::Value&&)>;
+
+  struct JobOptions {
+    bool profile_imports = false;
+    bool capture_output = false;
+    // Kept of each of stdout and stderr when capturing
+    size_t max_output_bytes = 0;
+    // Shared memory of the blobs of the job, owned by the caller until the
+    // job is done
+    python_utils::SharedBlobFds blobs;
+    // Inline source run instead of the file, owned by the caller as well
+    int code_fd = -1;
+  };
+
+  struct Job {
+    std::string file_execution_path;
+    JobOptions options;
+    ResultCallback on_done;
+
+    // Set while a thread runs the job, to interrupt it
+    std::mutex mtx;
+    std::condition_variable cond;
+    python_utils::PyInterpreterState* interpreter = nullptr;
+    unsigned long thread_id = 0;
+    bool finished = false;
+    // Set while an interrupt uses the interpreter, which must not end then
+    bool interrupting = false;
+  };
+
+  PythonSubinterpreterPool(std::string default_python_library_path,
+                           std::string python_library_path,
+                           size_t pool_size,
+                           size_t max_jobs_per_interpreter,
+                           std::string bytecode_cache_dir = "");
+  ~PythonSubinterpreterPool();
+
+  // Loads the runtime and starts the threads, false when subinterpreters
+  // are not available
+  bool Start();
+
+  // Runs the file on the next free thread, `on_done` is called from that
+  // thread once the script returned. Destroying the pool waits for the
+  // running scripts, queued ones fail.
+  std::shared_ptr<Job> Submit(std::string file_execution_path, JobOptions options,
+                              ResultCallback on_done);
+
+  // Raises TimeoutError in the script of `job` if it still runs. Pure Python
+  // code stops at its next bytecode, blocking C calls only once they return.
+  static void Interrupt(const std::shared_ptr<Job>& job);
+
+ private:
+  // Shared with the threads, which may outlive the pool
+  struct JobQueue {
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<Job>> pending_jobs;
+    bool running = true;
+  };
+
+  static void Run(std::shared_ptr<JobQueue> queue,
+                  std::string default_python_library_path,
+                  bool is_default_python_lib,
+                  size_t max_jobs_per_interpreter,
+                  std::string bytecode_cache_dir);
+
+  std::string default_python_library_path_;
+  std::string python_library_path_;
+  size_t pool_size_;
+  size_t max_jobs_per_interpreter_;
+  std::string bytecode_cache_dir_;
+
+  std::shared_ptr<JobQueue> queue_ = std::make_shared<JobQueue>();
+  std::vector<std::thread> threads_;
+};
+#endif
@@ -1,12 +1,24 @@
 #pragma once
 
 #include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
-#include <regex>
+#include <fstream>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <iostream>
 #include <dlfcn.h>
 
+#include "src/python_script_source.h"
+#include "src/python_startup_profile.h"
+#include "src/sha256.h"
 #include "trantor/utils/Logger.h"
 
 #if defined(_WIN32)
@@ -42,12 +54,247 @@ typedef void (*Py_InitializeFunc)();
 typedef void (*Py_FinalizeFunc)();
 typedef void (*PyErr_PrintFunc)();
 typedef int (*PyRun_SimpleStringFunc)(const char*);
-typedef int (*PyRun_SimpleFileFunc)(FILE*, const char*);
 typedef int (*PyList_InsertFunc)(PyObject*, Py_ssize_t, PyObject*);
 typedef int (*PyList_SetSliceFunc)(PyObject*, Py_ssize_t, Py_ssize_t, PyObject*);
 typedef PyObject* (*PySys_GetObjectFunc)(const char*);
 typedef PyObject* (*PyUnicode_FromStringFunc)(const char*);
 typedef Py_ssize_t (*PyList_SizeFunc)(PyObject*);
+typedef PyObject* (*PyDict_NewFunc)();
+typedef int (*PyDict_SetItemStringFunc)(PyObject*, const char*, PyObject*);
+typedef PyObject* (*PyEval_GetBuiltinsFunc)();
+typedef void (*Py_DecRefFunc)(PyObject*);
+typedef void (*PyErr_ClearFunc)();
+typedef int (*PyErr_ExceptionMatchesFunc)(PyObject*);
+typedef void (*PyOS_ForkHookFunc)();
+typedef void (*Py_SetPathFunc)(const wchar_t*);
+typedef wchar_t* (*Py_DecodeLocaleFunc)(const char*, size_t*);
+typedef void (*PyMem_RawFreeFunc)(void*);
+typedef void (*PyErr_SetStringFunc)(PyObject*, const char*);
+typedef void (*PyMem_SetAllocatorFunc)(int, PyMemAllocatorEx*);
+typedef PyObject* (*Py_CompileStringExFlagsFunc)(const char*, const char*, int, void*, int);
+typedef PyObject* (*PyEval_EvalCodeFunc)(PyObject*, PyObject*, PyObject*);
+typedef PyObject* (*PyMarshal_WriteObjectToStringFunc)(PyObject*, int);
+typedef PyObject* (*PyMarshal_ReadObjectFromStringFunc)(const char*, Py_ssize_t);
+typedef int (*PyBytes_AsStringAndSizeFunc)(PyObject*, char**, Py_ssize_t*);
+typedef long (*PyImport_GetMagicNumberFunc)();
+typedef PyObject* (*PyImport_AddModuleFunc)(const char*);
+typedef PyObject* (*PyModule_GetDictFunc)(PyObject*);
+typedef PyObject* (*PyObject_GetAttrStringFunc)(PyObject*, const char*);
+typedef long (*PyLong_AsLongFunc)(PyObject*);
+typedef void (*PyErr_FetchFunc)(PyObject**, PyObject**, PyObject**);
+typedef void (*PyErr_RestoreFunc)(PyObject*, PyObject*, PyObject*);
+typedef PyObject* (*PyTuple_GetItemFunc)(PyObject*, Py_ssize_t);
+typedef int (*PyObject_IsTrueFunc)(PyObject*);
+
+// Thread and interpreter states, only handled through pointers
+typedef struct _ts PyThreadState;
+typedef struct _is PyInterpreterState;
+// Same layout as PyStatus and PyInterpreterConfig of Python 3.12+
+struct PyStatus {
+  int type;
+  const char* func;
+  const char* err_msg;
+  int exitcode;
+};
+struct PyInterpreterConfig {
+  int use_main_obmalloc;
+  int allow_fork;
+  int allow_exec;
+  int allow_threads;
+  int allow_daemon_threads;
+  int check_multi_interp_extensions;
+  int gil;
+};
+constexpr const int kPyInterpreterConfigOwnGil = 2;
+// Room for a PyConfig of any supported version, which is only handled
+// through the PyConfig_* functions
+struct PyConfig {
+  alignas(alignof(std::max_align_t)) unsigned char storage[4096];
+};
+// Leading fields of PyConfig, laid out the same in every supported version
+struct PyConfigHead {
+  int _config_init;
+  int isolated;
+  int use_environment;
+  int dev_mode;
+  int install_signal_handlers;
+  int use_hash_seed;
+  unsigned long hash_seed;
+};
+typedef void (*PyConfig_InitPythonConfigFunc)(PyConfig*);
+typedef PyStatus (*PyConfig_SetBytesArgvFunc)(PyConfig*, Py_ssize_t, char* const*);
+typedef void (*PyConfig_ClearFunc)(PyConfig*);
+typedef PyStatus (*Py_InitializeFromConfigFunc)(const PyConfig*);
+typedef void (*Py_InitializeExFunc)(int);
+typedef PyInterpreterState* (*PyInterpreterState_MainFunc)();
+typedef PyStatus (*Py_NewInterpreterFromConfigFunc)(PyThreadState**, const PyInterpreterConfig*);
+typedef void (*Py_EndInterpreterFunc)(PyThreadState*);
+typedef PyThreadState* (*PyEval_SaveThreadFunc)();
+typedef void (*PyEval_RestoreThreadFunc)(PyThreadState*);
+typedef PyInterpreterState* (*PyThreadState_GetInterpreterFunc)(PyThreadState*);
+typedef PyThreadState* (*PyThreadState_NewFunc)(PyInterpreterState*);
+typedef void (*PyThreadState_ClearFunc)(PyThreadState*);
+typedef void (*PyThreadState_DeleteCurrentFunc)();
+typedef int (*PyThreadState_SetAsyncExcFunc)(unsigned long, PyObject*);
+typedef unsigned long (*PyThread_get_thread_identFunc)();
+
+// Start symbol for PyRun_* functions executing a sequence of statements
+constexpr const int kPyFileInput = 257;
+// Format of marshalled code objects, unchanged since Python 3.4
+constexpr const int kPyMarshalVersion = 4;
+
+// Entry points of a loaded libpython, resolved once per loaded library and
+// shared by every execution path. Required entry points are checked when
+// binding; optional ones stay null on runtimes too old to provide them.
+struct PythonApi {
+  PY_DL library = nullptr;
+
+  Py_InitializeExFunc Py_InitializeEx = nullptr;
+  Py_FinalizeFunc Py_Finalize = nullptr;
+  PyErr_PrintFunc PyErr_Print = nullptr;
+  PyErr_ClearFunc PyErr_Clear = nullptr;
+  PyErr_ExceptionMatchesFunc PyErr_ExceptionMatches = nullptr;
+  PyErr_SetStringFunc PyErr_SetString = nullptr;
+  PyRun_SimpleStringFunc PyRun_SimpleString = nullptr;
+  PySys_GetObjectFunc PySys_GetObject = nullptr;
+  PyList_InsertFunc PyList_Insert = nullptr;
+  PyList_SetSliceFunc PyList_SetSlice = nullptr;
+  PyList_SizeFunc PyList_Size = nullptr;
+  PyUnicode_FromStringFunc PyUnicode_FromString = nullptr;
+  PyDict_NewFunc PyDict_New = nullptr;
+  PyDict_SetItemStringFunc PyDict_SetItemString = nullptr;
+  PyEval_GetBuiltinsFunc PyEval_GetBuiltins = nullptr;
+  Py_DecRefFunc Py_DecRef = nullptr;
+  PyObject** PyExc_SystemExit = nullptr;
+  PyObject** PyExc_TimeoutError = nullptr;
+  PyObject** PyExc_ValueError = nullptr;
+  PyEval_SaveThreadFunc PyEval_SaveThread = nullptr;
+  PyEval_RestoreThreadFunc PyEval_RestoreThread = nullptr;
+  PyInterpreterState_MainFunc PyInterpreterState_Main = nullptr;
+  PyThreadState_NewFunc PyThreadState_New = nullptr;
+  PyThreadState_ClearFunc PyThreadState_Clear = nullptr;
+  PyThreadState_DeleteCurrentFunc PyThreadState_DeleteCurrent = nullptr;
+  PyThreadState_SetAsyncExcFunc PyThreadState_SetAsyncExc = nullptr;
+  PyThread_get_thread_identFunc PyThread_get_thread_ident = nullptr;
+  Py_DecodeLocaleFunc Py_DecodeLocale = nullptr;
+  PyMem_RawFreeFunc PyMem_RawFree = nullptr;
+  PyMem_SetAllocatorFunc PyMem_SetAllocator = nullptr;
+  PyConfig_InitPythonConfigFunc PyConfig_InitPythonConfig = nullptr;
+  PyConfig_SetBytesArgvFunc PyConfig_SetBytesArgv = nullptr;
+  PyConfig_ClearFunc PyConfig_Clear = nullptr;
+  Py_InitializeFromConfigFunc Py_InitializeFromConfig = nullptr;
+  Py_CompileStringExFlagsFunc Py_CompileStringExFlags = nullptr;
+  PyEval_EvalCodeFunc PyEval_EvalCode = nullptr;
+  PyMarshal_WriteObjectToStringFunc PyMarshal_WriteObjectToString = nullptr;
+  PyMarshal_ReadObjectFromStringFunc PyMarshal_ReadObjectFromString = nullptr;
+  PyBytes_AsStringAndSizeFunc PyBytes_AsStringAndSize = nullptr;
+  PyImport_GetMagicNumberFunc PyImport_GetMagicNumber = nullptr;
+  PyImport_AddModuleFunc PyImport_AddModule = nullptr;
+  PyModule_GetDictFunc PyModule_GetDict = nullptr;
+  PyObject_GetAttrStringFunc PyObject_GetAttrString = nullptr;
+  PyLong_AsLongFunc PyLong_AsLong = nullptr;
+  PyErr_FetchFunc PyErr_Fetch = nullptr;
+  PyErr_RestoreFunc PyErr_Restore = nullptr;
+  PyTuple_GetItemFunc PyTuple_GetItem = nullptr;
+  PyObject_IsTrueFunc PyObject_IsTrue = nullptr;
+
+  PyOS_ForkHookFunc PyOS_BeforeFork = nullptr;
+  PyOS_ForkHookFunc PyOS_AfterFork_Parent = nullptr;
+  PyOS_ForkHookFunc PyOS_AfterFork_Child = nullptr;
+
+  // Removed in Python 3.13
+  Py_SetPathFunc Py_SetPath = nullptr;
+  // Python 3.9+
+  PyThreadState_GetInterpreterFunc PyThreadState_GetInterpreter = nullptr;
+  // Python 3.12+
+  Py_NewInterpreterFromConfigFunc Py_NewInterpreterFromConfig = nullptr;
+  Py_EndInterpreterFunc Py_EndInterpreter = nullptr;
+
+  // Returns false, naming the missing symbols, when a required entry point
+  // is not exported by `py_dl`. Every required one exists since Python 3.8,
+  // the oldest runtime supported.
+  bool Bind(PY_DL py_dl) {
+    library = py_dl;
+    bool bound = true;
+#define PY_API_REQUIRED(name) bound &= Resolve(#name, name, true)
+#define PY_API_OPTIONAL(name) Resolve(#name, name, false)
+    PY_API_REQUIRED(Py_InitializeEx);
+    PY_API_REQUIRED(Py_Finalize);
+    PY_API_REQUIRED(PyErr_Print);
+    PY_API_REQUIRED(PyErr_Clear);
+    PY_API_REQUIRED(PyErr_ExceptionMatches);
+    PY_API_REQUIRED(PyErr_SetString);
+    PY_API_REQUIRED(PyRun_SimpleString);
+    PY_API_REQUIRED(PySys_GetObject);
+    PY_API_REQUIRED(PyList_Insert);
+    PY_API_REQUIRED(PyList_SetSlice);
+    PY_API_REQUIRED(PyList_Size);
+    PY_API_REQUIRED(PyUnicode_FromString);
+    PY_API_REQUIRED(PyDict_New);
+    PY_API_REQUIRED(PyDict_SetItemString);
+    PY_API_REQUIRED(PyEval_GetBuiltins);
+    PY_API_REQUIRED(Py_DecRef);
+    PY_API_REQUIRED(PyExc_SystemExit);
+    PY_API_REQUIRED(PyExc_TimeoutError);
+    PY_API_REQUIRED(PyExc_ValueError);
+    PY_API_REQUIRED(PyEval_SaveThread);
+    PY_API_REQUIRED(PyEval_RestoreThread);
+    PY_API_REQUIRED(PyInterpreterState_Main);
+    PY_API_REQUIRED(PyThreadState_New);
+    PY_API_REQUIRED(PyThreadState_Clear);
+    PY_API_REQUIRED(PyThreadState_DeleteCurrent);
+    PY_API_REQUIRED(PyThreadState_SetAsyncExc);
+    PY_API_REQUIRED(PyThread_get_thread_ident);
+    PY_API_REQUIRED(Py_DecodeLocale);
+    PY_API_REQUIRED(PyMem_RawFree);
+    PY_API_REQUIRED(PyMem_SetAllocator);
+    PY_API_REQUIRED(PyConfig_InitPythonConfig);
+    PY_API_REQUIRED(PyConfig_SetBytesArgv);
+    PY_API_REQUIRED(PyConfig_Clear);
+    PY_API_REQUIRED(Py_InitializeFromConfig);
+    PY_API_REQUIRED(Py_CompileStringExFlags);
+    PY_API_REQUIRED(PyEval_EvalCode);
+    PY_API_REQUIRED(PyMarshal_WriteObjectToString);
+    PY_API_REQUIRED(PyMarshal_ReadObjectFromString);
+    PY_API_REQUIRED(PyBytes_AsStringAndSize);
+    PY_API_REQUIRED(PyImport_GetMagicNumber);
+    PY_API_REQUIRED(PyImport_AddModule);
+    PY_API_REQUIRED(PyModule_GetDict);
+    PY_API_REQUIRED(PyObject_GetAttrString);
+    PY_API_REQUIRED(PyLong_AsLong);
+    PY_API_REQUIRED(PyErr_Fetch);
+    PY_API_REQUIRED(PyErr_Restore);
+    PY_API_REQUIRED(PyTuple_GetItem);
+    PY_API_REQUIRED(PyObject_IsTrue);
+#if !defined(_WIN32)
+    // Only exported where Python can fork
+    PY_API_REQUIRED(PyOS_BeforeFork);
+    PY_API_REQUIRED(PyOS_AfterFork_Parent);
+    PY_API_REQUIRED(PyOS_AfterFork_Child);
+#endif
+    PY_API_OPTIONAL(Py_SetPath);
+    PY_API_OPTIONAL(PyThreadState_GetInterpreter);
+    PY_API_OPTIONAL(Py_NewInterpreterFromConfig);
+    PY_API_OPTIONAL(Py_EndInterpreter);
+#undef PY_API_REQUIRED
+#undef PY_API_OPTIONAL
+    return bound;
+  }
+
+  bool HasOwnGilSubinterpreters() const {
+    return PyThreadState_GetInterpreter && Py_NewInterpreterFromConfig && Py_EndInterpreter;
+  }
+
+ private:
+  template <typename T>
+  bool Resolve(const char* name, T& entry_point, bool required) {
+    entry_point = reinterpret_cast<T>(GET_PY_FUNC(library, name));
+    if (!entry_point && required) {
+      LOG_ERROR << "Python library does not export " << name;
+    }
+    return entry_point != nullptr || !required;
+  }
+};
 
 inline void SignalHandler(int signum) {
   LOG_WARN << "Interrupt signal (" << signum << ") received.";
@@ -112,73 +359,331 @@ inline std::string GetDirectoryPathFromFilePath(std::string file_path) {
   }
 }
 
-inline std::string FindPythonDynamicLib(const std::string& lib_dir) {
-  std::string pattern;
+// Skips the digits at `pos`, returns false when there are none
+inline bool SkipDigits(const std::string& s, size_t& pos) {
+  size_t start = pos;
+  while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') {
+    pos++;
+  }
+  return pos > start;
+}
+
+// Skips `literal` at `pos`, returns false when it is not there
+inline bool SkipLiteral(const std::string& s, size_t& pos, const char* literal) {
+  size_t length = strlen(literal);
+  if (s.compare(pos, length, literal) != 0) {
+    return false;
+  }
+  pos += length;
+  return true;
+}
+
+// Whether `file_name` is a Python shared library: python310.dll on Windows,
+// libpython3.10.dylib on macOS, libpython3.10.so[.*] elsewhere
+inline bool IsPythonDynamicLibName(const std::string& file_name) {
+  size_t pos = 0;
 #if defined(_WIN32) || defined(_WIN64)
-  // Windows
-  // python310.dll
-  pattern = "python[0-9][0-9]+\\.dll";
+  return SkipLiteral(file_name, pos, "python") && SkipDigits(file_name, pos) && pos >= 8 &&
+         SkipLiteral(file_name, pos, ".dll") && pos == file_name.size();
 #elif defined(__APPLE__) || defined(__MACH__)
-  // macOS
-  pattern = "libpython[0-9]+\\.[0-9]+\\.dylib";
+  return SkipLiteral(file_name, pos, "libpython") && SkipDigits(file_name, pos) &&
+         SkipLiteral(file_name, pos, ".") && SkipDigits(file_name, pos) &&
+         SkipLiteral(file_name, pos, ".dylib") && pos == file_name.size();
 #else
-  // Linux or other Unix-like systems
-  pattern = "libpython[0-9]+\\.[0-9]+\\.so.*";
+  return SkipLiteral(file_name, pos, "libpython") && SkipDigits(file_name, pos) &&
+         SkipLiteral(file_name, pos, ".") && SkipDigits(file_name, pos) &&
+         SkipLiteral(file_name, pos, ".so");
 #endif
-  std::regex regex_pattern(pattern);
-  for (const auto& entry : std::filesystem::directory_iterator(lib_dir)) {
+}
+
+inline std::string FindPythonDynamicLib(const std::string& lib_dir) {
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(lib_dir, ec)) {
     std::string file_name = entry.path().filename().string();
-    if (std::regex_match(file_name, regex_pattern)) {
+    if (IsPythonDynamicLibName(file_name)) {
       return entry.path().string();
     }
   }
   return ""; // Return an empty string if no matching library is found
 }
 
-inline void ClearAndSetPythonSysPath(std::string default_py_lib_path, PY_DL py_dl) {  
-  auto python_sys_get_object_func = (PySys_GetObjectFunc)GET_PY_FUNC(py_dl, "PySys_GetObject");
-  auto python_list_insert_func = (PyList_InsertFunc)GET_PY_FUNC(py_dl, "PyList_Insert");
-  auto python_unicode_from_string_func = (PyUnicode_FromStringFunc)GET_PY_FUNC(py_dl, "PyUnicode_FromString");
-  auto python_list_set_slice_func = (PyList_SetSliceFunc)GET_PY_FUNC(py_dl, "PyList_SetSlice");
-  auto python_list_size_func = (PyList_SizeFunc)GET_PY_FUNC(py_dl, "PyList_Size");
-  PyObject* sys_path = python_sys_get_object_func("path");
-  python_list_set_slice_func(sys_path, 0, python_list_size_func(sys_path), NULL);
+// Python shared library found in each library directory, scanned again only
+// once the directory changed. Lookups cost a stat of the directory.
+class PythonRuntimeRegistry {
+ public:
+  static PythonRuntimeRegistry& Instance() {
+    static PythonRuntimeRegistry registry;
+    return registry;
+  }
+
+  std::string FindPythonDynamicLib(const std::string& lib_dir) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(lib_dir, ec);
+    if (ec) {
+      return "";
+    }
+    std::lock_guard<std::mutex> l(mtx_);
+    auto it = entries_.find(lib_dir);
+    if (it != entries_.end() && it->second.mtime == mtime) {
+      return it->second.py_dl_path;
+    }
+    std::string py_dl_path = python_utils::FindPythonDynamicLib(lib_dir);
+    entries_[lib_dir] = {mtime, py_dl_path};
+    return py_dl_path;
+  }
+
+ private:
+  struct Entry {
+    std::filesystem::file_time_type mtime;
+    std::string py_dl_path;
+  };
+
+  std::mutex mtx_;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+// sys.path of the default Python library, in order
+inline std::vector<std::string> GetDefaultPythonSysPath(const std::string& default_py_lib_path) {
+#if defined(_WIN32)
+  return {default_py_lib_path + "Lib/site-packages/", default_py_lib_path + "Lib/",
+          default_py_lib_path + "DLLs/", default_py_lib_path};
+#else
+  return {default_py_lib_path + "lib/python/site-packages/",
+          default_py_lib_path + "lib/python/lib-dynload/",
+          default_py_lib_path + "lib/python/"};
+#endif
+}
+
+// Image of the compiled standard library packed at build time by
+// scripts/pack_python_stdlib.py, and the loose tree it was packed from
+inline std::string GetPackedStdlibPath(const std::string& default_py_lib_path) {
 #if defined(_WIN32)
-  std::vector<PyObject*> pathStrings = {
-      python_unicode_from_string_func((default_py_lib_path).c_str()),
-      python_unicode_from_string_func((default_py_lib_path + "DLLs/").c_str()),
-      python_unicode_from_string_func((default_py_lib_path + "Lib/").c_str()),
-      python_unicode_from_string_func((default_py_lib_path + "Lib/site-packages/").c_str())};
+  return default_py_lib_path + "python-stdlib.img";
 #else
-  std::vector<PyObject*> pathStrings = {
-      python_unicode_from_string_func((default_py_lib_path + "lib/python/").c_str()),
-      python_unicode_from_string_func((default_py_lib_path + "lib/python/lib-dynload/").c_str()),
-      python_unicode_from_string_func((default_py_lib_path + "lib/python/site-packages/").c_str())};
+  return default_py_lib_path + "lib/python-stdlib.img";
 #endif
+}
 
-  if (sys_path) {
-    for(PyObject* pathString : pathStrings) {
-      python_list_insert_func(sys_path, 0, pathString);
+inline std::string GetPackedStdlibRoot(const std::string& default_py_lib_path) {
+#if defined(_WIN32)
+  return default_py_lib_path + "Lib/";
+#else
+  return default_py_lib_path + "lib/python/";
+#endif
+}
+
+// Serves the modules of a packed standard library from a read-only mapping
+// of its image, ahead of the path based finder, so importing them costs no
+// file system lookup. Modules keep the paths of their sources in the loose
+// tree. The image holds unoptimized code, it is skipped under -O.
+constexpr const char* kInstallPackedStdlib = R"(
+def _install_packed_stdlib(image_path, root):
+    import _imp, marshal, mmap, sys
+    import _frozen_importlib as bootstrap
+    import _frozen_importlib_external as external
+    if sys.flags.optimize:
+        return
+    with open(image_path, 'rb') as f:
+        image = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    if image[:8] != b'CXPYSTD1' or image[8:12] != external.MAGIC_NUMBER:
+        raise ImportError(image_path + ' was packed for another Python version')
+    index_size = int.from_bytes(image[12:16], 'little')
+    index = marshal.loads(image[16:16 + index_size])
+    base = 16 + index_size
+
+    class PackedStdlibFinder:
+        @classmethod
+        def find_spec(cls, name, path=None, target=None):
+            entry = index.get(name)
+            if entry is None:
+                return None
+            origin = root + entry[3]
+            spec = bootstrap.ModuleSpec(name, cls, origin=origin, is_package=entry[2])
+            spec.has_location = True
+            if entry[2]:
+                spec.submodule_search_locations = [origin.rpartition('/')[0]]
+            return spec
+
+        @staticmethod
+        def create_module(spec):
+            return None
+
+        @staticmethod
+        def get_resource_reader(name):
+            from importlib.readers import FileReader
+            return FileReader(type('', (), {'path': root + index[name][3]}))
+
+        @staticmethod
+        def exec_module(module):
+            offset, size, _, _ = index[module.__spec__.name]
+            code = marshal.loads(image[base + offset:base + offset + size])
+            _imp._fix_co_filename(code, module.__spec__.origin)
+            exec(code, module.__dict__)
+
+    position = len(sys.meta_path)
+    if external.PathFinder in sys.meta_path:
+        position = sys.meta_path.index(external.PathFinder)
+    sys.meta_path.insert(position, PackedStdlibFinder)
+)";
+
+// Single quoted Python literal of `value`
+inline std::string PythonStringLiteral(const std::string& value) {
+  std::string literal = "'";
+  for (char c : value) {
+    if (c == '\\' || c == '\'') {
+      literal += '\\';
+      literal += c;
+    } else if (c == '\n') {
+      literal += "\\n";
+    } else if (c == '\r') {
+      literal += "\\r";
+    } else {
+      literal += c;
     }
   }
+  return literal + "'";
 }
 
-inline void ExecutePythonFile(std::string binary_exec_path, std::string py_file_path ,std::string py_lib_path) {
+// Imports the standard library of the default Python library from its
+// packed image, when it ships one. Failures leave the loose tree in charge.
+inline void InstallPackedStdlib(const std::string& default_py_lib_path, const PythonApi& api) {
+  std::string image_path = GetPackedStdlibPath(default_py_lib_path);
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(image_path, ec)) {
+    return;
+  }
+  std::string install = std::string(kInstallPackedStdlib) +
+                        "try:\n"
+                        "    _install_packed_stdlib(" + PythonStringLiteral(image_path) + ", " +
+                        PythonStringLiteral(GetPackedStdlibRoot(default_py_lib_path)) + ")\n"
+                        "finally:\n"
+                        "    del _install_packed_stdlib\n";
+  if (api.PyRun_SimpleString(install.c_str()) != 0) {
+    LOG_WARN << "Failed to load the packed standard library " << image_path;
+  }
+}
+
+inline void ClearAndSetPythonSysPath(std::string default_py_lib_path, const PythonApi& api) {
+  PyObject* sys_path = api.PySys_GetObject("path");
+  if (!sys_path) {
+    return;
+  }
+  api.PyList_SetSlice(sys_path, 0, api.PyList_Size(sys_path), NULL);
+  Py_ssize_t index = 0;
+  for (const auto& path : GetDefaultPythonSysPath(default_py_lib_path)) {
+    PyObject* path_string = api.PyUnicode_FromString(path.c_str());
+    api.PyList_Insert(sys_path, index++, path_string);
+    api.Py_DecRef(path_string);
+  }
+}
+
+// Starts the interpreter of a child process from a PyConfig carrying the
+// options of `profile`, on the allocator it picks. sys.path is set up front
+// for the default library (`default_sys_path_lib` not empty) where the
+// runtime still allows it, which skips computing the regular one.
+inline bool StartPythonRuntime(const PythonApi& api, const PythonStartupProfile& profile,
+                               const std::string& default_sys_path_lib) {
+  // Before anything is allocated, memory must be freed by the allocator
+  // which allocated it
+  PyMemAllocatorEx allocator;
+  if (GetReplacementAllocator(profile.allocator, allocator)) {
+    for (int domain : {kPyMemDomainRaw, kPyMemDomainMem, kPyMemDomainObj}) {
+      api.PyMem_SetAllocator(domain, &allocator);
+    }
+    LOG_DEBUG << "Python allocates memory with " << profile.allocator;
+  } else if (!IsAllocatorAvailable(profile.allocator)) {
+    LOG_WARN << "Allocator " << profile.allocator << " is not built in, keeping pymalloc";
+  }
+
+  bool sys_path_set = false;
+  if (default_sys_path_lib != "" && api.Py_SetPath) {
+#if defined(_WIN32)
+    const char* separator = ";";
+#else
+    const char* separator = ":";
+#endif
+    std::string joined;
+    for (const auto& path : GetDefaultPythonSysPath(default_sys_path_lib)) {
+      joined += (joined.empty() ? "" : separator) + path;
+    }
+    wchar_t* search_path = api.Py_DecodeLocale(joined.c_str(), nullptr);
+    if (search_path) {
+      api.Py_SetPath(search_path);
+      api.PyMem_RawFree(search_path);
+      sys_path_set = true;
+    }
+  }
 
-  signal(SIGINT, SignalHandler);
-  std::string binary_dir_path = python_utils::GetDirectoryPathFromFilePath(binary_exec_path);
+  std::vector<std::string> args = {"python"};
+  for (auto& arg : profile.InterpreterArgs()) {
+    args.push_back(std::move(arg));
+  }
+  std::vector<char*> argv;
+  for (auto& arg : args) {
+    argv.push_back(&arg[0]);
+  }
+
+  PyConfig config;
+  api.PyConfig_InitPythonConfig(&config);
+  if (profile.hash_seed >= 0) {
+    // Unlike PYTHONHASHSEED it does not reach subprocesses of the script,
+    // and isolated mode keeps it
+    auto* head = reinterpret_cast<PyConfigHead*>(config.storage);
+    head->use_hash_seed = 1;
+    head->hash_seed = static_cast<unsigned long>(profile.hash_seed);
+  }
+  PyStatus status = api.PyConfig_SetBytesArgv(&config, argv.size(), argv.data());
+  if (status.type == 0) {
+    status = api.Py_InitializeFromConfig(&config);
+  }
+  api.PyConfig_Clear(&config);
+  if (status.type != 0) {
+    LOG_ERROR << "Failed to start Python runtime: " << (status.err_msg ? status.err_msg : "unknown error");
+    return false;
+  }
+
+  if (default_sys_path_lib != "" && !sys_path_set) {
+    ClearAndSetPythonSysPath(default_sys_path_lib, api);
+  }
+  if (default_sys_path_lib != "" && profile.packed_stdlib) {
+    InstallPackedStdlib(default_sys_path_lib, api);
+  }
+  return true;
+}
+
+// Default Python library shipped with the engine, for a binary installed
+// next to the `engines/` folder
+inline std::string GetDefaultPythonLibraryPath(std::string binary_exec_path) {
+  return python_utils::GetDirectoryPathFromFilePath(binary_exec_path) + "engines/cortex.python/python/";
+}
+
+// Locates, loads and initializes the Python runtime found in `py_lib_path`
+// (or in `default_py_lib_path` when empty), unless the caller already
+// resolved its shared library as `py_dl_path`. On success `api` is bound to
+// the loaded library and the interpreter is ready to run code. A runtime
+// hosted by the server itself must leave the signal handlers of the server
+// alone, it starts without the options of `profile`.
+inline bool InitializePythonRuntime(std::string default_py_lib_path, std::string py_lib_path,
+                                    std::string py_dl_path, const PythonStartupProfile& profile,
+                                    PythonApi& api, bool install_signal_handlers = true) {
+
+  if (install_signal_handlers) {
+    signal(SIGINT, SignalHandler);
+  }
 
   bool is_default_python_lib = false;
   if (py_lib_path == "") {
     is_default_python_lib = true;
-    py_lib_path = binary_dir_path + "engines/cortex.python/python/";
+    py_lib_path = default_py_lib_path;
     LOG_WARN << "No specified Python library path, using default Python library in " << py_lib_path;
   }
 
-  std::string py_dl_path = FindPythonDynamicLib(py_lib_path);
+  if (py_dl_path == "") {
+    py_dl_path = PythonRuntimeRegistry::Instance().FindPythonDynamicLib(py_lib_path);
+  }
   if (py_dl_path == "") {
     LOG_ERROR << "Could not find Python dynamic library file in path: " << py_lib_path;
-    return;
+    return false;
   } else {
     LOG_DEBUG << "Found dynamic library file " << py_dl_path;;
   }
@@ -186,47 +691,794 @@ inline void ExecutePythonFile(std::string binary_exec_path, std::string py_file_
   PY_DL py_dl = PY_LOAD_LIB(py_dl_path);
   if (!py_dl) {
     LOG_ERROR << "Failed to load Python dynamic library from file: " << py_dl_path;
-    return;
+    return false;
   } else {
     LOG_INFO << "Successully loaded Python dynamic library from path: " << py_dl_path;
   }
 
-  auto python_initialize_func = (Py_InitializeFunc)GET_PY_FUNC(py_dl, "Py_Initialize");
-  auto python_finalize_func = (Py_FinalizeFunc)GET_PY_FUNC(py_dl, "Py_Finalize");
-  auto python_err_print = (PyErr_PrintFunc)GET_PY_FUNC(py_dl, "PyErr_Print");
-  auto python_run_simple_string_func = (PyRun_SimpleStringFunc)GET_PY_FUNC(py_dl, "PyRun_SimpleString");
-  auto python_run_simple_pile_func = (PyRun_SimpleFileFunc)GET_PY_FUNC(py_dl, "PyRun_SimpleFile");
-
-  if (!python_initialize_func || !python_finalize_func || !python_err_print 
-      || !python_run_simple_string_func || !python_run_simple_pile_func) {
-    LOG_ERROR << "Failed to bind necessary Python functions";
+  if (!api.Bind(py_dl)) {
+    LOG_ERROR << "Failed to bind necessary Python functions, Python 3.8 or later is needed";
     PY_FREE_LIB(py_dl);
-    return;
+    return false;
   }
 
-  // Start Python runtime
-  python_initialize_func();
+  // Start Python runtime, with the sys paths of the default library
+  if (install_signal_handlers) {
+    if (!StartPythonRuntime(api, profile, is_default_python_lib ? py_lib_path : "")) {
+      PY_FREE_LIB(py_dl);
+      return false;
+    }
+  } else {
+    api.Py_InitializeEx(0);
+    if (is_default_python_lib) {
+      ClearAndSetPythonSysPath(py_lib_path, api);
+    }
+  }
+  return true;
+}
+
+inline void FinalizePythonRuntime(const PythonApi& api) {
+  api.Py_Finalize();
+  PY_FREE_LIB(api.library);
+}
 
-  if (is_default_python_lib) {
-    // Re-route the sys paths to Python default library
-    ClearAndSetPythonSysPath(py_lib_path, py_dl);
+// What Py_Finalize does first and scripts may rely on: joining non-daemon
+// threads, running atexit handlers and flushing the standard streams
+constexpr const char* kRunExitHandlers = R"(
+def _run_exit_handlers():
+    import sys
+    threading = sys.modules.get('threading')
+    if threading is not None:
+        threading._shutdown()
+    import atexit
+    atexit._run_exitfuncs()
+    for stream in (sys.stdout, sys.stderr):
+        try:
+            stream.flush()
+        except Exception:
+            pass
+_run_exit_handlers()
+)";
+
+// Ends a one-shot process without tearing the interpreter down. Collecting
+// and deallocating every object and module right before the process exits
+// is wasted work, only the exit handlers run.
+[[noreturn]] inline void FastExitPythonRuntime(const PythonApi& api, int exit_code) {
+  api.PyRun_SimpleString(kRunExitHandlers);
+  fflush(stdout);
+  fflush(stderr);
+  std::_Exit(exit_code);
+}
+
+// Writes `path` through a temporary file renamed over it, so concurrent
+// readers and writers never see a partial file
+inline bool WriteFileAtomically(const std::string& path, const char* data, size_t size) {
+#if defined(_WIN32)
+  unsigned long pid = GetCurrentProcessId();
+#else
+  unsigned long pid = getpid();
+#endif
+  std::string tmp_path = path + "." + std::to_string(pid) + "." +
+                         std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+  std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+  file.write(data, size);
+  file.close();
+  std::error_code ec;
+  if (!file || (std::filesystem::rename(tmp_path, path, ec), ec)) {
+    std::filesystem::remove(tmp_path, ec);
+    return false;
   }
+  return true;
+}
 
+// Where the code of `source` is cached in `bytecode_cache_dir`. Code objects
+// depend on the bytecode format, the optimization level and the file name
+// reported in tracebacks, the key covers all of them along with the source.
+inline std::string GetBytecodeCachePath(const PythonApi& api, const std::string& bytecode_cache_dir,
+                                        const std::string& py_file_path, const ScriptSource& source) {
+  long optimize = 0;
+  PyObject* flags = api.PySys_GetObject("flags");
+  PyObject* optimize_flag = flags ? api.PyObject_GetAttrString(flags, "optimize") : nullptr;
+  if (optimize_flag) {
+    optimize = api.PyLong_AsLong(optimize_flag);
+    api.Py_DecRef(optimize_flag);
+  } else {
+    api.PyErr_Clear();
+  }
+
+  Sha256 hash;
+  hash.Update(std::to_string(api.PyImport_GetMagicNumber()) + "\n" + std::to_string(optimize) + "\n");
+  // File names cannot hold a NUL, it ends the name unambiguously
+  hash.Update(py_file_path.c_str(), py_file_path.size() + 1);
+  hash.Update(source.data(), source.size());
+  return (std::filesystem::path(bytecode_cache_dir) / (hash.HexDigest() + ".code")).string();
+}
+
+// Compiles `source`, named `py_file_path` in tracebacks. With a
+// `bytecode_cache_dir`, code cached there for the same source is loaded
+// instead and freshly compiled code is stored for the next run. Returns a
+// new reference, or null with the Python error set.
+inline PyObject* CompilePythonSource(const PythonApi& api, const std::string& py_file_path,
+                                     const ScriptSource& source, const std::string& bytecode_cache_dir) {
+  std::string cache_path;
+  if (bytecode_cache_dir != "") {
+    cache_path = GetBytecodeCachePath(api, bytecode_cache_dir, py_file_path, source);
+    // Entries are only ever replaced by a rename, mapping them is safe
+    ScriptSource cached;
+    if (cached.MapFile(cache_path)) {
+      PyObject* code = api.PyMarshal_ReadObjectFromString(cached.data(), cached.size());
+      if (code) {
+        LOG_DEBUG << "Loaded cached code of " << py_file_path << " from " << cache_path;
+        return code;
+      }
+      api.PyErr_Clear();
+      LOG_WARN << "Ignoring unreadable cached code " << cache_path;
+    }
+  }
+
+  std::string error = source.Validate();
+  if (error != "") {
+    api.PyErr_SetString(*api.PyExc_ValueError, (py_file_path + ": " + error).c_str());
+    return nullptr;
+  }
+  PyObject* code = api.Py_CompileStringExFlags(source.data(), py_file_path.c_str(), kPyFileInput, nullptr, -1);
+  if (!code || cache_path == "") {
+    return code;
+  }
+
+  PyObject* marshalled = api.PyMarshal_WriteObjectToString(code, kPyMarshalVersion);
+  char* data = nullptr;
+  Py_ssize_t size = 0;
+  if (marshalled && api.PyBytes_AsStringAndSize(marshalled, &data, &size) == 0) {
+    if (!WriteFileAtomically(cache_path, data, size)) {
+      LOG_WARN << "Failed to cache the code of " << py_file_path << " in " << cache_path;
+    }
+  } else {
+    api.PyErr_Clear();
+  }
+  if (marshalled) {
+    api.Py_DecRef(marshalled);
+  }
+  return code;
+}
+
+// Runs `source` with `globals`, returns the new reference of the result or
+// null with the Python error set
+inline PyObject* RunPythonSource(const PythonApi& api, const std::string& py_file_path,
+                                 const ScriptSource& source, PyObject* globals,
+                                 const std::string& bytecode_cache_dir) {
+  PyObject* code = CompilePythonSource(api, py_file_path, source, bytecode_cache_dir);
+  if (!code) {
+    return nullptr;
+  }
+  PyObject* result = api.PyEval_EvalCode(code, globals, globals);
+  api.Py_DecRef(code);
+  return result;
+}
+
+// Time spent loading one module, as `-X importtime` reports it: `self_us`
+// excludes the modules it imported, `cumulative_us` includes them
+struct ModuleImportTime {
+  std::string module;
+  int64_t self_us = 0;
+  int64_t cumulative_us = 0;
+};
+
+// Times every module load where -X importtime does, around
+// _find_and_load, which the interpreter looks up on importlib at each
+// import. Modules already loaded cost nothing and are not reported.
+constexpr const char* kStartImportProfile = R"(
+def _start_import_profile():
+    import _thread, sys, time
+    import _frozen_importlib as bootstrap
+    find_and_load = bootstrap._find_and_load
+    clock = time.perf_counter_ns
+    records = []
+    # Time spent in nested imports, per thread importing
+    stacks = {}
+
+    def _find_and_load(name, import_):
+        stack = stacks.setdefault(_thread.get_ident(), [])
+        stack.append(0)
+        start = clock()
+        try:
+            return find_and_load(name, import_)
+        finally:
+            elapsed = clock() - start
+            nested = stack.pop()
+            if stack:
+                stack[-1] += elapsed
+            records.append((name, (elapsed - nested) // 1000, elapsed // 1000))
+
+    bootstrap._find_and_load = _find_and_load
+    sys._cortex_import_profile = (find_and_load, records)
+try:
+    _start_import_profile()
+finally:
+    del _start_import_profile
+)";
+
+constexpr const char* kStopImportProfile = R"(
+def _stop_import_profile():
+    import sys
+    import _frozen_importlib as bootstrap
+    find_and_load, records = sys._cortex_import_profile
+    bootstrap._find_and_load = find_and_load
+    sys._cortex_import_profile = ''.join('%s\t%d\t%d\n' % record for record in records).encode()
+try:
+    _stop_import_profile()
+finally:
+    del _stop_import_profile
+)";
+
+inline void StartImportProfile(const PythonApi& api) {
+  if (api.PyRun_SimpleString(kStartImportProfile) != 0) {
+    LOG_WARN << "Failed to start profiling Python imports";
+  }
+}
+
+// Returns the modules loaded since StartImportProfile, in the order their
+// loading finished. An error raised by the script stays set.
+inline std::vector<ModuleImportTime> StopImportProfile(const PythonApi& api) {
+  PyObject* type;
+  PyObject* value;
+  PyObject* traceback;
+  api.PyErr_Fetch(&type, &value, &traceback);
+
+  std::vector<ModuleImportTime> imports;
+  char* data = nullptr;
+  Py_ssize_t size = 0;
+  PyObject* profile = nullptr;
+  if (api.PySys_GetObject("_cortex_import_profile") && api.PyRun_SimpleString(kStopImportProfile) == 0) {
+    profile = api.PySys_GetObject("_cortex_import_profile");
+  }
+  if (profile && api.PyBytes_AsStringAndSize(profile, &data, &size) == 0) {
+    // One "module\tself_us\tcumulative_us" line per module
+    std::string lines(data, size);
+    size_t start = 0;
+    size_t end;
+    while ((end = lines.find('\n', start)) != std::string::npos) {
+      std::string line = lines.substr(start, end - start);
+      start = end + 1;
+      size_t self_pos = line.find('\t');
+      size_t cumulative_pos = line.find('\t', self_pos + 1);
+      if (self_pos == std::string::npos || cumulative_pos == std::string::npos) {
+        continue;
+      }
+      ModuleImportTime time;
+      time.module = line.substr(0, self_pos);
+      time.self_us = std::atoll(line.c_str() + self_pos + 1);
+      time.cumulative_us = std::atoll(line.c_str() + cumulative_pos + 1);
+      imports.push_back(std::move(time));
+    }
+  } else {
+    api.PyErr_Clear();
+    LOG_WARN << "Failed to collect the Python import profile";
+  }
+  api.PyRun_SimpleString("import sys\nsys.__dict__.pop('_cortex_import_profile', None)");
+
+  api.PyErr_Restore(type, value, traceback);
+  return imports;
+}
+
+// Output of a script, at most the size it was captured with
+struct CapturedOutput {
+  std::string stdout_data;
+  std::string stderr_data;
+  bool stdout_truncated = false;
+  bool stderr_truncated = false;
+};
+
+// Replaces sys.stdout and sys.stderr with writers keeping their UTF-8 up to
+// a size, for scripts sharing a process whose descriptors cannot be
+// redirected per execution. Output written to the descriptors themselves,
+// below Python, is not captured.
+constexpr const char* kStartOutputCapture = R"(
+def _start_output_capture(max_bytes):
+    import io, sys
+
+    class CappedOutput(io.TextIOBase):
+        encoding = 'utf-8'
+        errors = 'backslashreplace'
+
+        def __init__(self, name):
+            self.name = name
+            self.parts = []
+            self.size = 0
+            self.truncated = False
+
+        def writable(self):
+            return True
+
+        def write(self, text):
+            if not isinstance(text, str):
+                raise TypeError('write() argument must be str, not ' + type(text).__name__)
+            data = text.encode(self.encoding, self.errors)
+            room = max_bytes - self.size
+            if len(data) > room:
+                self.truncated = True
+                data = data[:room]
+            self.parts.append(data)
+            self.size += len(data)
+            return len(text)
+
+    captured = (CappedOutput('<stdout>'), CappedOutput('<stderr>'))
+    sys._cortex_output = (sys.stdout, sys.stderr) + captured
+    sys.stdout, sys.stderr = captured
+)";
+
+constexpr const char* kStopOutputCapture = R"(
+def _stop_output_capture():
+    import sys
+    stdout, stderr, captured_stdout, captured_stderr = sys._cortex_output
+    sys.stdout, sys.stderr = stdout, stderr
+    sys._cortex_output = (b''.join(captured_stdout.parts), captured_stdout.truncated,
+                          b''.join(captured_stderr.parts), captured_stderr.truncated)
+try:
+    _stop_output_capture()
+finally:
+    del _stop_output_capture
+)";
+
+inline void StartOutputCapture(const PythonApi& api, size_t max_bytes) {
+  std::string start = std::string(kStartOutputCapture) +
+                      "try:\n"
+                      "    _start_output_capture(" + std::to_string(max_bytes) + ")\n"
+                      "finally:\n"
+                      "    del _start_output_capture\n";
+  if (api.PyRun_SimpleString(start.c_str()) != 0) {
+    LOG_WARN << "Failed to capture the Python output";
+  }
+}
+
+// Restores the streams replaced by StartOutputCapture and returns what was
+// written to them
+inline CapturedOutput StopOutputCapture(const PythonApi& api) {
+  CapturedOutput output;
+  PyObject* captured = nullptr;
+  if (api.PySys_GetObject("_cortex_output") && api.PyRun_SimpleString(kStopOutputCapture) == 0) {
+    captured = api.PySys_GetObject("_cortex_output");
+  }
+  char* data = nullptr;
+  Py_ssize_t size = 0;
+  if (captured && api.PyBytes_AsStringAndSize(api.PyTuple_GetItem(captured, 0), &data, &size) == 0) {
+    output.stdout_data.assign(data, size);
+    output.stdout_truncated = api.PyObject_IsTrue(api.PyTuple_GetItem(captured, 1)) == 1;
+  }
+  if (captured && api.PyBytes_AsStringAndSize(api.PyTuple_GetItem(captured, 2), &data, &size) == 0) {
+    output.stderr_data.assign(data, size);
+    output.stderr_truncated = api.PyObject_IsTrue(api.PyTuple_GetItem(captured, 3)) == 1;
+  }
+  if (!captured) {
+    api.PyErr_Clear();
+    LOG_WARN << "Failed to collect the captured Python output";
+  }
+  api.PyRun_SimpleString("import sys\nsys.__dict__.pop('_cortex_output', None)");
+  return output;
+}
+
+// Name of inline sources in tracebacks, as for `python -c`
+constexpr const char* kInlineCodeName = "<string>";
+
+// Shared memory regions of an execution, -1 when it has none. Both hold
+// their blobs and the columns of their tables followed by a JSON table
+// {"blobs": {"name": [offset, length]}, "tables": {"name": ...}} and the
+// length of that table as 8 little-endian bytes. See python_arrow_tables.h
+// for the entries of tables.
+struct SharedBlobFds {
+  int input_fd = -1;
+  int output_fd = -1;
+};
+
+// Installs the cortex_blobs module: `inputs` maps names to read-only
+// memoryviews over the input region, `allocate_output` returns writable
+// memoryviews over the output region and `set_output` copies into one.
+// Outputs start at page boundaries so each can be mapped on its own.
+// `tables` maps names to the columns of input tables, whose buffers are
+// memoryviews over the region in the Arrow layout. `allocate_table` and
+// `set_table` return tables the same way.
+constexpr const char* kStartSharedBlobs = R"(
+def _start_shared_blobs(input_fd, output_fd):
+    import array, itertools, json, mmap, os, sys, types
+    region = mmap.mmap(input_fd, 0, prot=mmap.PROT_READ)
+    maps = [region]
+    view = memoryview(region)
+    table_size = int.from_bytes(view[-8:], 'little')
+    table = json.loads(bytes(view[-8 - table_size:-8]))
+    inputs = {name: view[offset:offset + length] for name, (offset, length) in table['blobs'].items()}
+    output_fd = os.dup(output_fd)
+    outputs = {}
+    output_tables = {}
+    end = 0
+
+    # Memoryview formats of the values of each Arrow format, booleans and
+    # variable length values are bytes
+    codes = {'c': 'b', 'C': 'B', 's': 'h', 'S': 'H', 'i': 'i', 'I': 'I', 'l': 'q', 'L': 'Q',
+             'e': 'e', 'f': 'f', 'g': 'd', 'b': 'B', 'u': 'B', 'z': 'B', 'U': 'B', 'Z': 'B'}
+    widths = {'c': 1, 'C': 1, 's': 2, 'S': 2, 'e': 2, 'i': 4, 'I': 4, 'f': 4, 'l': 8, 'L': 8, 'g': 8}
+    formats = {('b', 1): 'c', ('b', 2): 's', ('b', 4): 'i', ('b', 8): 'l',
+               ('B', 1): 'C', ('B', 2): 'S', ('B', 4): 'I', ('B', 8): 'L',
+               ('f', 2): 'e', ('f', 4): 'f', ('f', 8): 'g'}
+
+    class Column:
+        """Column of a table in the Arrow layout of its format: `values`,
+        delimited by `offsets` for strings and binaries, and a `validity`
+        bitmap which is None without nulls."""
+        __slots__ = ('format', 'length', 'null_count', 'validity', 'offsets', 'values')
+
+        def __init__(self, format, length, values, offsets=None, validity=None, null_count=0):
+            if format not in codes:
+                raise ValueError('unsupported column format %r' % format)
+            self.format = format
+            self.length = length
+            self.values = values
+            self.offsets = offsets
+            self.validity = validity
+            self.null_count = null_count
+
+        def __len__(self):
+            return self.length
+
+        def __repr__(self):
+            return 'Column(format=%r, length=%d, null_count=%d)' % (self.format, self.length, self.null_count)
+
+    def input_column(entry, length):
+        buffers = [None if b is None else view[b[0]:b[0] + b[1]] for b in entry['buffers']]
+        fmt = entry['format']
+        offsets = buffers[1].cast('i' if fmt in ('u', 'z') else 'q') if len(buffers) == 3 else None
+        return Column(fmt, length, buffers[-1].cast(codes[fmt]), offsets, buffers[0], entry['null_count'])
+
+    tables = {name: {entry['name']: input_column(entry, spec['length']) for entry in spec['columns']}
+              for name, spec in table['tables'].items()}
+
+    def allocate(size):
+        nonlocal end
+        offset = end
+        end += -(-size // mmap.ALLOCATIONGRANULARITY) * mmap.ALLOCATIONGRANULARITY
+        if size == 0:
+            return offset, memoryview(bytearray())
+        os.ftruncate(output_fd, end)
+        output = mmap.mmap(output_fd, size, offset=offset)
+        maps.append(output)
+        return offset, memoryview(output)
+
+    def allocate_output(name, size):
+        if not isinstance(name, str):
+            raise TypeError('output name must be str, not ' + type(name).__name__)
+        if name in outputs:
+            raise ValueError('output %r is already set' % name)
+        if size < 0:
+            raise ValueError('output size must not be negative')
+        offset, output = allocate(size)
+        outputs[name] = (offset, size)
+        return output
+
+    def set_output(name, data):
+        data = memoryview(data).cast('B')
+        allocate_output(name, data.nbytes)[:] = data
+
+    # Lays out the buffers of a table in one mapping, 64 byte aligned like
+    # Arrow buffers, and returns writable views of them. Columns are
+    # (name, format, null_count, [buffer size or None]).
+    def place_table(name, length, columns):
+        if not isinstance(name, str):
+            raise TypeError('table name must be str, not ' + type(name).__name__)
+        if name in output_tables:
+            raise ValueError('table %r is already set' % name)
+        for column_name, _, _, _ in columns:
+            if not isinstance(column_name, str):
+                raise TypeError('column name must be str, not ' + type(column_name).__name__)
+        size = 0
+        for _, _, _, sizes in columns:
+            for buffer_size in sizes:
+                if buffer_size is not None:
+                    size = -(-size // 64) * 64 + buffer_size
+        offset, output = allocate(size)
+        entries, views, position = [], [], 0
+        for column_name, fmt, null_count, sizes in columns:
+            buffers, column_views = [], []
+            for buffer_size in sizes:
+                if buffer_size is None:
+                    buffers.append(None)
+                    column_views.append(None)
+                    continue
+                position = -(-position // 64) * 64
+                buffers.append([offset + position, buffer_size])
+                column_views.append(output[position:position + buffer_size])
+                position += buffer_size
+            entries.append({'name': column_name, 'format': fmt, 'null_count': null_count, 'buffers': buffers})
+            views.append(column_views)
+        output_tables[name] = {'length': length, 'columns': entries}
+        return views
+
+    def allocate_table(name, length, column_formats):
+        if length < 0:
+            raise ValueError('table length must not be negative')
+        for fmt in column_formats.values():
+            if fmt not in widths:
+                raise ValueError('only fixed width columns can be allocated, not %r' % fmt)
+        views = place_table(name, length, [(column_name, fmt, 0, [None, length * widths[fmt]])
+                                           for column_name, fmt in column_formats.items()])
+        return {column_name: column_views[1].cast(codes[fmt])
+                for (column_name, fmt), column_views in zip(column_formats.items(), views)}
+
+    def sequence_column(items):
+        kinds = {type(item) for item in items if item is not None}
+        if kinds <= {str}:
+            fmt = 'u'
+            encoded = [b'' if item is None else item.encode() for item in items]
+        elif kinds <= {bytes, bytearray}:
+            fmt = 'z'
+            encoded = [b'' if item is None else bytes(item) for item in items]
+        else:
+            raise TypeError('sequence columns must hold str or bytes, and None for nulls')
+        values = b''.join(encoded)
+        offsets = array.array('q', itertools.accumulate((len(item) for item in encoded), initial=0))
+        if len(values) < 2 ** 31:
+            offsets = array.array('i', offsets)
+        else:
+            fmt = fmt.upper()
+        nulls = [i for i, item in enumerate(items) if item is None]
+        validity = None
+        if nulls:
+            validity = bytearray(b'\xff' * (-(-len(items) // 8)))
+            for i in nulls:
+                validity[i // 8] &= ~(1 << (i % 8))
+        return Column(fmt, len(items), memoryview(values), memoryview(offsets), validity, len(nulls))
+
+    def to_column(data):
+        if isinstance(data, Column):
+            return data
+        if isinstance(data, (list, tuple)):
+            return sequence_column(data)
+        values = memoryview(data)
+        code = values.format.lstrip('@=<')
+        kind = 'b' if code in ('b', 'h', 'i', 'l', 'q', 'n') else 'B' if code in ('B', 'H', 'I', 'L', 'Q', 'N') \
+            else 'f' if code in ('e', 'f', 'd') else None
+        fmt = formats.get((kind, values.itemsize))
+        if fmt is None:
+            raise TypeError('unsupported column format %r' % values.format)
+        if values.ndim != 1 or not values.c_contiguous:
+            raise ValueError('columns must be one-dimensional and contiguous')
+        return Column(fmt, len(values), values)
+
+    def set_table(name, columns):
+        columns = {column_name: to_column(data) for column_name, data in columns.items()}
+        lengths = {len(column) for column in columns.values()}
+        if len(lengths) > 1:
+            raise ValueError('columns of a table must have the same length')
+        specs, sources = [], []
+        for column_name, column in columns.items():
+            buffers = [column.validity if column.null_count else None]
+            buffers += [column.offsets] if column.offsets is not None else []
+            buffers = [None if b is None else memoryview(b).cast('B') for b in buffers + [column.values]]
+            specs.append((column_name, column.format, column.null_count,
+                          [None if b is None else b.nbytes for b in buffers]))
+            sources.append(buffers)
+        for targets, buffers in zip(place_table(name, lengths.pop() if lengths else 0, specs), sources):
+            for target, buffer in zip(targets, buffers):
+                if buffer is not None:
+                    target[:] = buffer
+
+    module = types.ModuleType('cortex_blobs')
+    module.inputs = inputs
+    module.allocate_output = allocate_output
+    module.set_output = set_output
+    module.Column = Column
+    module.tables = tables
+    module.allocate_table = allocate_table
+    module.set_table = set_table
+    sys.modules['cortex_blobs'] = module
+    sys._cortex_blobs = (maps, output_fd, outputs, output_tables, lambda: end)
+)";
+
+// Appends the table of the outputs, then unmaps the regions unless the
+// script still holds views of them
+constexpr const char* kStopSharedBlobs = R"(
+def _stop_shared_blobs():
+    import json, os, sys
+    maps, output_fd, outputs, output_tables, end = sys._cortex_blobs
+    sys.modules.pop('cortex_blobs', None)
+    try:
+        table = json.dumps({'blobs': {name: list(entry) for name, entry in outputs.items()},
+                            'tables': output_tables}).encode()
+        os.pwrite(output_fd, table + len(table).to_bytes(8, 'little'), end())
+    finally:
+        os.close(output_fd)
+        for region in maps:
+            try:
+                region.close()
+            except BufferError:
+                pass
+try:
+    _stop_shared_blobs()
+finally:
+    del _stop_shared_blobs
+)";
+
+inline bool StartSharedBlobs(const PythonApi& api, const SharedBlobFds& blobs) {
+  std::string start = std::string(kStartSharedBlobs) +
+                      "try:\n"
+                      "    _start_shared_blobs(" + std::to_string(blobs.input_fd) + ", " +
+                      std::to_string(blobs.output_fd) + ")\n"
+                      "finally:\n"
+                      "    del _start_shared_blobs\n";
+  if (api.PyRun_SimpleString(start.c_str()) != 0) {
+    LOG_WARN << "Failed to share the blobs of the execution with Python";
+    return false;
+  }
+  return true;
+}
+
+// Hands the outputs set since StartSharedBlobs to the engine. An error
+// raised by the script stays set.
+inline void StopSharedBlobs(const PythonApi& api) {
+  PyObject* type;
+  PyObject* value;
+  PyObject* traceback;
+  api.PyErr_Fetch(&type, &value, &traceback);
+  if (!api.PySys_GetObject("_cortex_blobs") || api.PyRun_SimpleString(kStopSharedBlobs) != 0) {
+    api.PyErr_Clear();
+    LOG_WARN << "Failed to return the output blobs of the execution";
+  }
+  api.PyRun_SimpleString("import sys\nsys.__dict__.pop('_cortex_blobs', None)");
+  api.PyErr_Restore(type, value, traceback);
+}
+
+inline void ExecutePythonFileWithDefaultLibrary(std::string default_py_lib_path, std::string py_file_path, std::string py_lib_path,
+                                                std::string py_dl_path = "",
+                                                const PythonStartupProfile& profile = {},
+                                                std::string bytecode_cache_dir = "",
+                                                bool fast_exit = false,
+                                                std::function<void(std::vector<ModuleImportTime>&&)> report_imports = nullptr,
+                                                const SharedBlobFds& blobs = {},
+                                                int source_fd = -1) {
+
+  PythonApi api;
+  if (!InitializePythonRuntime(default_py_lib_path, py_lib_path, py_dl_path, profile, api)) {
+    return;
+  }
+
+  // Inline source comes on `source_fd` instead, and is not cached
+  ScriptSource source;
+  bool mapped;
+#if defined(_WIN32)
   LOG_INFO << "Trying to run Python file in path " << py_file_path;
-  FILE* file = fopen(py_file_path.c_str(), "r");
-  if (file == NULL) {
+  mapped = source.MapFile(py_file_path);
+#else
+  if (source_fd >= 0) {
+    LOG_INFO << "Trying to run inline Python code";
+    py_file_path = kInlineCodeName;
+    bytecode_cache_dir = "";
+    mapped = source.MapFd(source_fd);
+  } else {
+    LOG_INFO << "Trying to run Python file in path " << py_file_path;
+    mapped = source.MapFile(py_file_path);
+  }
+#endif
+  if (!mapped) {
     LOG_ERROR << "Failed to open file " << py_file_path;
   } else {
-    if (python_run_simple_pile_func(file, py_file_path.c_str() ) != 0) {
-      python_err_print();
+    // Same namespace as PyRun_SimpleFile, SystemExit still ends the process
+    PyObject* globals = api.PyModule_GetDict(api.PyImport_AddModule("__main__"));
+    PyObject* file_name = api.PyUnicode_FromString(py_file_path.c_str());
+    api.PyDict_SetItemString(globals, "__file__", file_name);
+    api.Py_DecRef(file_name);
+    bool share_blobs = blobs.input_fd >= 0 && StartSharedBlobs(api, blobs);
+    if (report_imports) {
+      StartImportProfile(api);
+    }
+    PyObject* result = RunPythonSource(api, py_file_path, source, globals, bytecode_cache_dir);
+    // Reported before the error is printed, SystemExit ends the process there
+    if (report_imports) {
+      report_imports(StopImportProfile(api));
+    }
+    if (share_blobs) {
+      StopSharedBlobs(api);
+    }
+    if (result) {
+      api.Py_DecRef(result);
+    } else {
+      api.PyErr_Print();
       LOG_ERROR << "Failed to execute file " << py_file_path;
     }
-    fclose(file);
   }
 
-  python_finalize_func();
-  PY_FREE_LIB(py_dl);
+  if (fast_exit) {
+    FastExitPythonRuntime(api, 0);
+  }
+  FinalizePythonRuntime(api);
+}
+
+inline void ExecutePythonFile(std::string binary_exec_path, std::string py_file_path ,std::string py_lib_path) {
+  ExecutePythonFileWithDefaultLibrary(GetDefaultPythonLibraryPath(binary_exec_path), py_file_path, py_lib_path);
+}
+
+// Writes out what Python and C buffered for the standard streams
+inline void FlushStandardStreams(const PythonApi& api) {
+  api.PyRun_SimpleString("import sys; sys.stdout.flush(); sys.stderr.flush()");
+  fflush(stdout);
+  fflush(stderr);
 }
 
+// Runs `source` inside an already initialized interpreter, in a fresh
+// `__main__`-like namespace so that globals of one script do not leak into
+// the next one. `py_file_path` names the script in `__file__` and tracebacks.
+// SystemExit raised by the script only ends the script, not the hosting
+// process. The modules it loads are profiled into `imports` when it is set,
+// and it reaches the shared memory of `blobs` through cortex_blobs when it
+// has some. Returns 0 on success.
+inline int RunPythonSourceInFreshNamespace(const PythonApi& api, const std::string& py_file_path,
+                                           const ScriptSource& source,
+                                           const std::string& bytecode_cache_dir = "",
+                                           std::vector<ModuleImportTime>* imports = nullptr,
+                                           const SharedBlobFds& blobs = {}) {
+  PyObject* globals = api.PyDict_New();
+  PyObject* main_name = api.PyUnicode_FromString("__main__");
+  PyObject* file_name = api.PyUnicode_FromString(py_file_path.c_str());
+  api.PyDict_SetItemString(globals, "__name__", main_name);
+  api.PyDict_SetItemString(globals, "__file__", file_name);
+  api.PyDict_SetItemString(globals, "__builtins__", api.PyEval_GetBuiltins());
+
+  int rc = 0;
+  bool share_blobs = blobs.input_fd >= 0 && StartSharedBlobs(api, blobs);
+  if (imports) {
+    StartImportProfile(api);
+  }
+  PyObject* result = RunPythonSource(api, py_file_path, source, globals, bytecode_cache_dir);
+  if (imports) {
+    *imports = StopImportProfile(api);
+  }
+  if (share_blobs) {
+    StopSharedBlobs(api);
+  }
+  if (result) {
+    api.Py_DecRef(result);
+  } else if (api.PyErr_ExceptionMatches(*api.PyExc_SystemExit)) {
+    api.PyErr_Clear();
+  } else {
+    api.PyErr_Print();
+    LOG_ERROR << "Failed to execute file " << py_file_path;
+    rc = 1;
+  }
+
+  api.Py_DecRef(file_name);
+  api.Py_DecRef(main_name);
+  api.Py_DecRef(globals);
+
+  // Output of one job must not linger in the buffers of the next one
+  FlushStandardStreams(api);
+  return rc;
+}
+
+// Maps the Python file at `py_file_path` and runs it as above
+inline int RunPythonFileInFreshNamespace(const PythonApi& api, const std::string& py_file_path,
+                                         const std::string& bytecode_cache_dir = "",
+                                         std::vector<ModuleImportTime>* imports = nullptr,
+                                         const SharedBlobFds& blobs = {}) {
+  LOG_INFO << "Trying to run Python file in path " << py_file_path;
+  ScriptSource source;
+  if (!source.MapFile(py_file_path)) {
+    LOG_ERROR << "Failed to open file " << py_file_path;
+    return 1;
+  }
+  return RunPythonSourceInFreshNamespace(api, py_file_path, source, bytecode_cache_dir, imports, blobs);
+}
+
+#if !defined(_WIN32)
+// Maps the inline source open on `source_fd` and runs it as above. Snippets
+// skip the bytecode cache, each distinct one would add an entry.
+inline int RunPythonCodeInFreshNamespace(const PythonApi& api, int source_fd,
+                                         std::vector<ModuleImportTime>* imports = nullptr,
+                                         const SharedBlobFds& blobs = {}) {
+  LOG_INFO << "Trying to run inline Python code";
+  ScriptSource source;
+  if (!source.MapFd(source_fd)) {
+    LOG_ERROR << "Failed to map inline Python code";
+    return 1;
+  }
+  return RunPythonSourceInFreshNamespace(api, kInlineCodeName, source, "", imports, blobs);
+}
+#endif
 
 } // namespace python_utils
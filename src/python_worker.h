@@ -0,0 +1,349 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <cctype>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/cgroup_manager.h"
+#include "src/python_import_profile.h"
+#include "src/python_utils.h"
+#include "src/python_worker_protocol.h"
+
+namespace python_worker {
+
+// Points the standard output and error of the process at the pipes of one
+// job while it runs
+class ScopedOutputRedirect {
+ public:
+  ScopedOutputRedirect(const python_utils::PythonApi& api, int stdout_fd, int stderr_fd) : api_(api) {
+    python_utils::FlushStandardStreams(api_);
+    saved_stdout_ = dup(STDOUT_FILENO);
+    saved_stderr_ = dup(STDERR_FILENO);
+    dup2(stdout_fd, STDOUT_FILENO);
+    dup2(stderr_fd, STDERR_FILENO);
+  }
+
+  ~ScopedOutputRedirect() {
+    python_utils::FlushStandardStreams(api_);
+    dup2(saved_stdout_, STDOUT_FILENO);
+    dup2(saved_stderr_, STDERR_FILENO);
+    close(saved_stdout_);
+    close(saved_stderr_);
+  }
+
+  ScopedOutputRedirect(const ScopedOutputRedirect&) = delete;
+  ScopedOutputRedirect& operator=(const ScopedOutputRedirect&) = delete;
+
+ private:
+  const python_utils::PythonApi& api_;
+  int saved_stdout_;
+  int saved_stderr_;
+};
+
+// Descriptors passed along with a job, in this order after those of the
+// channel itself. -1 for those the job does not have.
+struct JobFds {
+  int stdout_fd = -1;
+  int stderr_fd = -1;
+  python_utils::SharedBlobFds blobs;
+  int code_fd = -1;
+
+  // Takes the descriptors `job` announces from `fds`, starting at `first`.
+  // False when they do not match.
+  bool Parse(const Json::Value& job, const std::vector<int>& fds, size_t first) {
+    size_t next = first;
+    auto take = [&fds, &next](int& fd) {
+      if (next < fds.size()) {
+        fd = fds[next];
+      }
+      next++;
+    };
+    if (job.get("capture_output", false).asBool()) {
+      take(stdout_fd);
+      take(stderr_fd);
+    }
+    if (job.get("shared_blobs", false).asBool()) {
+      take(blobs.input_fd);
+      take(blobs.output_fd);
+    }
+    if (job.get("inline_code", false).asBool()) {
+      take(code_fd);
+    }
+    return next == fds.size();
+  }
+};
+
+// Runs the file or inline source of `job`
+inline int RunJob(const python_utils::PythonApi& api, const Json::Value& job, const JobFds& job_fds,
+                  const std::string& bytecode_cache_dir,
+                  std::vector<python_utils::ModuleImportTime>* imports) {
+  if (job_fds.code_fd >= 0) {
+    return python_utils::RunPythonCodeInFreshNamespace(api, job_fds.code_fd, imports, job_fds.blobs);
+  }
+  return python_utils::RunPythonFileInFreshNamespace(api, job.get("file_execution_path", "").asString(),
+                                                     bytecode_cache_dir, imports, job_fds.blobs);
+}
+
+// Main loop of a warm worker process. The interpreter is started once, then
+// every job received on the channel runs in it until the engine closes the
+// channel. Each job is answered with its exit code, and the imports of the
+// script when the job asks for them. A job capturing its output comes with
+// the pipes replacing stdout and stderr while it runs, followed by the shared
+// memory of its blobs when it has some, then its source when it is inline.
+// See JobFds.
+inline int RunPythonWorker(std::string default_py_lib_path, const PythonRuntimeArgs& runtime) {
+  python_utils::PythonApi api;
+  if (!python_utils::InitializePythonRuntime(default_py_lib_path, runtime.python_library_path,
+                                             runtime.python_dynamic_lib_path,
+                                             runtime.startup_profile, api)) {
+    return 1;
+  }
+
+  MessageChannel channel(kWorkerChannelFd);
+  Json::Value job;
+  std::vector<int> fds;
+  while (channel.Receive(job, fds)) {
+    Json::Value result;
+    std::vector<python_utils::ModuleImportTime> imports;
+    bool profile_imports = job.get("profile_imports", false).asBool();
+    JobFds job_fds;
+    if (!job_fds.Parse(job, fds, 0)) {
+      LOG_ERROR << "Worker job without its descriptors";
+      result["exit_code"] = 1;
+    } else {
+      std::unique_ptr<ScopedOutputRedirect> redirect;
+      if (job_fds.stdout_fd >= 0) {
+        redirect = std::make_unique<ScopedOutputRedirect>(api, job_fds.stdout_fd, job_fds.stderr_fd);
+      }
+      result["exit_code"] = RunJob(api, job, job_fds, runtime.bytecode_cache_dir,
+                                   profile_imports ? &imports : nullptr);
+    }
+    for (int fd : fds) {
+      close(fd);
+    }
+    fds.clear();
+    if (profile_imports) {
+      result["imports"] = PythonRuntime::ImportProfile::ToJson(imports);
+    }
+    if (!channel.Send(result)) {
+      break;
+    }
+  }
+
+  close(kWorkerChannelFd);
+  python_utils::FinalizePythonRuntime(api);
+  return 0;
+}
+
+// Module names are spliced into Python source, only accept dotted identifiers
+inline bool IsValidModuleName(const std::string& name) {
+  if (name.empty() || name.front() == '.' || name.back() == '.') {
+    return false;
+  }
+  for (char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '.') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Imports `modules` once and moves every object alive at that point out of
+// the reach of the garbage collector, so forked children do not touch (and
+// copy) the shared pages while collecting.
+inline void PreloadPythonModules(const python_utils::PythonApi& api, const Json::Value& modules) {
+  for (const auto& module : modules) {
+    std::string name = module.asString();
+    if (!IsValidModuleName(name)) {
+      LOG_WARN << "Skipping invalid module name to preload: " << name;
+      continue;
+    }
+    if (api.PyRun_SimpleString(("import " + name).c_str()) != 0) {
+      LOG_WARN << "Failed to preload Python module " << name;
+    } else {
+      LOG_INFO << "Preloaded Python module " << name;
+    }
+  }
+
+  api.PyRun_SimpleString("import gc\nif hasattr(gc, 'freeze'): gc.freeze()");
+}
+
+// Main loop of a fork server. The interpreter is started once and the
+// modules listed in the first message are imported and acknowledged, then
+// every job forks a child which shares those pages copy-on-write. A job message carries one
+// descriptor on which the child reports its exit code, followed by those of
+// JobFds; the zygote answers with the pid of the child.
+inline int RunPythonZygote(std::string default_py_lib_path, const PythonRuntimeArgs& runtime) {
+  python_utils::PythonApi api;
+  if (!python_utils::InitializePythonRuntime(default_py_lib_path, runtime.python_library_path,
+                                             runtime.python_dynamic_lib_path,
+                                             runtime.startup_profile, api)) {
+    return 1;
+  }
+
+  MessageChannel channel(kWorkerChannelFd);
+  Json::Value init;
+  if (!channel.Receive(init)) {
+    python_utils::FinalizePythonRuntime(api);
+    return 1;
+  }
+  PreloadPythonModules(api, init["preload_modules"]);
+
+  // Jobs carry descriptors, they may only be sent once the init message is consumed
+  Json::Value ready;
+  ready["ready"] = true;
+  if (!channel.Send(ready)) {
+    python_utils::FinalizePythonRuntime(api);
+    return 1;
+  }
+
+  // Children are reaped by the kernel, their outcome goes over the job channel
+  signal(SIGCHLD, SIG_IGN);
+
+  Json::Value job;
+  std::vector<int> fds;
+  while (channel.Receive(job, fds)) {
+    Json::Value ack;
+    JobFds job_fds;
+    if (fds.empty() || !job_fds.Parse(job, fds, 1)) {
+      LOG_ERROR << "Fork server job without its descriptors";
+      for (int fd : fds) {
+        close(fd);
+      }
+      fds.clear();
+      ack["pid"] = -1;
+      channel.Send(ack);
+      continue;
+    }
+    int job_fd = fds[0];
+
+    if (job_fds.stdout_fd >= 0) {
+      // Nothing the zygote buffered may end up in the output of the child
+      python_utils::FlushStandardStreams(api);
+    }
+    api.PyOS_BeforeFork();
+    pid_t pid = fork();
+    if (pid == 0) {
+      // Its own process group, a timeout kills whatever the script started
+      setpgid(0, 0);
+      api.PyOS_AfterFork_Child();
+      signal(SIGCHLD, SIG_DFL);
+      close(kWorkerChannelFd);
+      if (job_fds.stdout_fd >= 0) {
+        dup2(job_fds.stdout_fd, STDOUT_FILENO);
+        dup2(job_fds.stderr_fd, STDERR_FILENO);
+        close(job_fds.stdout_fd);
+        close(job_fds.stderr_fd);
+      }
+
+#if defined(__linux__)
+      // Exiting without a result fails the execution, it never runs unlimited
+      std::string cgroup_path = job.get("cgroup_path", "").asString();
+      if (cgroup_path != "" && !cgroup::JoinCgroup(cgroup_path.c_str())) {
+        LOG_ERROR << "Failed to join cgroup " << cgroup_path << ": " << strerror(errno);
+        _exit(1);
+      }
+#endif
+
+      Json::Value result;
+      std::vector<python_utils::ModuleImportTime> imports;
+      bool profile_imports = job.get("profile_imports", false).asBool();
+      int exit_code = RunJob(api, job, job_fds, runtime.bytecode_cache_dir,
+                             profile_imports ? &imports : nullptr);
+      result["exit_code"] = exit_code;
+      if (profile_imports) {
+        result["imports"] = PythonRuntime::ImportProfile::ToJson(imports);
+      }
+      MessageChannel(job_fd).Send(result);
+      // Stays around until the engine closed the job channel, so its pid
+      // cannot be reused while a timeout of the engine may still signal it
+      char byte;
+      ssize_t n;
+      do {
+        n = read(job_fd, &byte, 1);
+      } while (n > 0 || (n < 0 && errno == EINTR));
+      close(job_fd);
+
+      if (runtime.fast_exit) {
+        python_utils::FastExitPythonRuntime(api, exit_code);
+      }
+      python_utils::FinalizePythonRuntime(api);
+      _exit(exit_code);
+    }
+    api.PyOS_AfterFork_Parent();
+    for (int fd : fds) {
+      close(fd);
+    }
+    fds.clear();
+    if (pid > 0) {
+      // Set from both sides, the engine may signal the group right away
+      setpgid(pid, pid);
+    }
+
+    if (pid < 0) {
+      LOG_ERROR << "Failed to fork Python child: " << strerror(errno);
+    }
+    ack["pid"] = pid;
+    if (!channel.Send(ack)) {
+      break;
+    }
+  }
+
+  close(kWorkerChannelFd);
+  python_utils::FinalizePythonRuntime(api);
+  return 0;
+}
+
+// Entry point of a child process of the engine, `argv` as the engine spawns
+// it: --run_python_file, --run_python_worker or --run_python_zygote followed
+// by the arguments of PythonRuntimeArgs. Returns its exit code.
+inline int RunPythonChildProcess(const std::string& default_py_lib_path, int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "--run_python_file") == 0) {
+    auto runtime = PythonRuntimeArgs::FromArgv(argc, argv, 3);
+#if defined(__linux__)
+    // Before anything of the script runs, it never runs unlimited
+    if (runtime.cgroup_path != "" && !cgroup::JoinCgroup(runtime.cgroup_path.c_str())) {
+      LOG_ERROR << "Failed to join cgroup " << runtime.cgroup_path << ": " << strerror(errno);
+      return kCgroupJoinFailedExitCode;
+    }
+#endif
+    std::function<void(std::vector<python_utils::ModuleImportTime>&&)> report_imports;
+    if (runtime.profile_imports) {
+      report_imports = [](std::vector<python_utils::ModuleImportTime>&& imports) {
+        Json::Value result;
+        result["imports"] = PythonRuntime::ImportProfile::ToJson(imports);
+        MessageChannel(kWorkerChannelFd).Send(result);
+        close(kWorkerChannelFd);
+      };
+    }
+    python_utils::SharedBlobFds blobs;
+    if (runtime.shared_blobs) {
+      blobs = {kSharedBlobInputFd, kSharedBlobOutputFd};
+    }
+    int source_fd = runtime.inline_code ? kInlineCodeFd : -1;
+    python_utils::ExecutePythonFileWithDefaultLibrary(default_py_lib_path, argv[2], runtime.python_library_path,
+                                                      runtime.python_dynamic_lib_path, runtime.startup_profile,
+                                                      runtime.bytecode_cache_dir, runtime.fast_exit,
+                                                      std::move(report_imports), blobs, source_fd);
+    return 0;
+  }
+  if (argc > 1 && strcmp(argv[1], "--run_python_worker") == 0) {
+    return RunPythonWorker(default_py_lib_path, PythonRuntimeArgs::FromArgv(argc, argv, 2));
+  }
+  if (argc > 1 && strcmp(argv[1], "--run_python_zygote") == 0) {
+    return RunPythonZygote(default_py_lib_path, PythonRuntimeArgs::FromArgv(argc, argv, 2));
+  }
+
+  LOG_ERROR << "Unknown child process arguments" << (argc > 1 ? std::string(" ") + argv[1] : "");
+  return 1;
+}
+
+} // namespace python_worker
+
+#endif
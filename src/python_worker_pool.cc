@@ -0,0 +1,168 @@
+#include "python_worker_pool.h"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstring>
+#include <sys/wait.h>
+
+#include "trantor/utils/Logger.h"
+
+PythonWorkerPool::PythonWorkerPool(std::string worker_exe_path,
+                                   python_worker::PythonRuntimeArgs runtime,
+                                   size_t pool_size,
+                                   size_t max_jobs_per_worker,
+                                   process_spawn::SpawnStrategy spawn_strategy,
+                                   ChildProcessReactor& reactor)
+    : worker_exe_path_(std::move(worker_exe_path)),
+      runtime_(std::move(runtime)),
+      pool_size_(pool_size > 0 ? pool_size : 1),
+      max_jobs_per_worker_(max_jobs_per_worker),
+      spawn_strategy_(spawn_strategy),
+      reactor_(reactor) {
+  // Start every worker right away so they are warm by the first request
+  std::unique_lock<std::mutex> l(mtx_);
+  Dispatch(l);
+  LOG_INFO << "Started " << idle_workers_.size() << " Python workers";
+}
+
+PythonWorkerPool::~PythonWorkerPool() {
+  // Busy workers keep the pool alive, only idle ones are left here
+  for (auto& worker : idle_workers_) {
+    close(worker->channel->fd());
+  }
+  for (auto& worker : idle_workers_) {
+    waitpid(worker->pid, nullptr, 0);
+  }
+  for (auto& pending : pending_jobs_) {
+    pending.on_done(false, Json::Value());
+  }
+}
+
+void PythonWorkerPool::Submit(Json::Value job, ResultCallback on_done,
+                              StartedCallback on_started, std::vector<int> fds) {
+  std::unique_lock<std::mutex> l(mtx_);
+  pending_jobs_.push_back({std::move(job), std::move(on_done), std::move(on_started), std::move(fds)});
+  auto failed = Dispatch(l);
+  l.unlock();
+
+  for (auto& on_failed : failed) {
+    on_failed(false, Json::Value());
+  }
+}
+
+std::unique_ptr<PythonWorkerPool::Worker> PythonWorkerPool::SpawnWorker() {
+  std::vector<std::string> worker_args = {"--run_python_worker"};
+  runtime_.AppendTo(worker_args);
+
+  pid_t pid;
+  int fd = python_worker::SpawnWithChannel(worker_exe_path_, worker_args, spawn_strategy_, pid);
+  if (fd < 0) {
+    LOG_ERROR << "Failed to spawn Python worker: " << strerror(errno);
+    return nullptr;
+  }
+
+  auto worker = std::make_unique<Worker>();
+  worker->pid = pid;
+  worker->channel = std::make_unique<python_worker::MessageChannel>(fd);
+  return worker;
+}
+
+void PythonWorkerPool::DestroyWorker(std::unique_ptr<Worker> worker) {
+  // Closing the channel ends the worker loop, the reactor reaps it
+  close(worker->channel->fd());
+  reactor_.WatchChild(worker->pid, [](int) {});
+}
+
+std::vector<PythonWorkerPool::ResultCallback> PythonWorkerPool::Dispatch(
+    std::unique_lock<std::mutex>& /*l*/) {
+  // Keep the pool warm, replacing workers which exited or were recycled
+  while (idle_workers_.size() + busy_workers_.size() < pool_size_) {
+    auto worker = SpawnWorker();
+    if (!worker) {
+      break;
+    }
+    idle_workers_.push_back(std::move(worker));
+  }
+
+  std::vector<ResultCallback> failed;
+  while (!pending_jobs_.empty()) {
+    if (idle_workers_.empty()) {
+      if (busy_workers_.empty()) {
+        // Not a single worker could be started
+        for (auto& pending : pending_jobs_) {
+          failed.push_back(std::move(pending.on_done));
+        }
+        pending_jobs_.clear();
+      }
+      break;
+    }
+
+    auto worker = std::move(idle_workers_.back());
+    idle_workers_.pop_back();
+    auto pending = std::move(pending_jobs_.front());
+    pending_jobs_.pop_front();
+
+    if (!worker->channel->Send(pending.job, pending.fds)) {
+      // An idle worker may have died since its last job, retry with another one
+      LOG_WARN << "Python worker " << worker->pid << " is gone, retrying with another one";
+      DestroyWorker(std::move(worker));
+      pending_jobs_.push_front(std::move(pending));
+      auto replacement = SpawnWorker();
+      if (replacement) {
+        idle_workers_.push_back(std::move(replacement));
+      }
+      continue;
+    }
+
+    if (pending.on_started) {
+      pending.on_started(worker->pid);
+    }
+    int fd = worker->channel->fd();
+    worker->on_done = std::move(pending.on_done);
+    busy_workers_[fd] = std::move(worker);
+    reactor_.WatchFd(fd, [self = shared_from_this(), fd] {
+      self->OnWorkerReadable(fd);
+    });
+  }
+  return failed;
+}
+
+void PythonWorkerPool::OnWorkerReadable(int fd) {
+  std::unique_lock<std::mutex> l(mtx_);
+  auto it = busy_workers_.find(fd);
+  if (it == busy_workers_.end()) {
+    return;
+  }
+
+  bool open = it->second->channel->ReadAvailable();
+  Json::Value result;
+  bool answered = it->second->channel->PopMessage(result);
+  if (!answered && open) {
+    return;
+  }
+
+  auto worker = std::move(it->second);
+  busy_workers_.erase(it);
+  reactor_.UnwatchFd(fd);
+  auto on_done = std::move(worker->on_done);
+
+  if (!answered) {
+    LOG_ERROR << "Python worker " << worker->pid << " exited unexpectedly";
+    DestroyWorker(std::move(worker));
+  } else if (max_jobs_per_worker_ > 0 && ++worker->jobs_done >= max_jobs_per_worker_) {
+    LOG_DEBUG << "Recycling Python worker " << worker->pid << " after "
+              << worker->jobs_done << " jobs";
+    DestroyWorker(std::move(worker));
+  } else {
+    idle_workers_.push_back(std::move(worker));
+  }
+
+  auto failed = Dispatch(l);
+  l.unlock();
+
+  on_done(answered, std::move(result));
+  for (auto& on_failed : failed) {
+    on_failed(false, Json::Value());
+  }
+}
+#endif
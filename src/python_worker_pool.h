@@ -0,0 +1,81 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "json/value.h"
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+
+#include "src/child_process_reactor.h"
+#include "src/python_worker_protocol.h"
+
+// Pool of long-lived worker processes which already loaded and initialized
+// the Python runtime of one library path and startup profile. Jobs are
+// handed to an idle worker over its channel, so a request only pays for
+// running the script itself. Jobs beyond the pool size wait in FIFO order
+// for a worker to be released.
+class PythonWorkerPool : public std::enable_shared_from_this<PythonWorkerPool> {
+ public:
+  // Receives whether a worker ran the job, and its result
+  using ResultCallback = std::function<void(bool, Json::Value&&)>;
+  // Receives the pid of the worker a job was handed to, called with the
+  // pool locked, it must not block
+  using StartedCallback = std::function<void(pid_t)>;
+
+  PythonWorkerPool(std::string worker_exe_path,
+                   python_worker::PythonRuntimeArgs runtime,
+                   size_t pool_size,
+                   size_t max_jobs_per_worker,
+                   process_spawn::SpawnStrategy spawn_strategy,
+                   ChildProcessReactor& reactor);
+  ~PythonWorkerPool();
+
+  // Runs `job` on the next idle worker, `on_done` is called from the reactor
+  // thread once the worker answered. `fds` are passed along with the job and
+  // must stay open until then.
+  void Submit(Json::Value job, ResultCallback on_done, StartedCallback on_started = nullptr,
+              std::vector<int> fds = {});
+
+ private:
+  struct Worker {
+    pid_t pid;
+    std::unique_ptr<python_worker::MessageChannel> channel;
+    size_t jobs_done = 0;
+    ResultCallback on_done;
+  };
+
+  struct PendingJob {
+    Json::Value job;
+    ResultCallback on_done;
+    StartedCallback on_started;
+    std::vector<int> fds;
+  };
+
+  std::unique_ptr<Worker> SpawnWorker();
+  void DestroyWorker(std::unique_ptr<Worker> worker);
+  // Hands pending jobs to idle workers, called with `mtx_` held. Returns
+  // the callbacks of jobs which cannot run at all, to be called unlocked.
+  std::vector<ResultCallback> Dispatch(std::unique_lock<std::mutex>& l);
+  void OnWorkerReadable(int fd);
+
+  std::string worker_exe_path_;
+  python_worker::PythonRuntimeArgs runtime_;
+  size_t pool_size_;
+  size_t max_jobs_per_worker_;
+  process_spawn::SpawnStrategy spawn_strategy_;
+  ChildProcessReactor& reactor_;
+
+  std::mutex mtx_;
+  std::vector<std::unique_ptr<Worker>> idle_workers_;
+  // Workers running a job, by channel fd
+  std::unordered_map<int, std::unique_ptr<Worker>> busy_workers_;
+  std::deque<PendingJob> pending_jobs_;
+};
+#endif
@@ -0,0 +1,326 @@
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+#include "json/reader.h"
+#include "json/value.h"
+#include "json/writer.h"
+#include "src/process_spawn.h"
+#include "src/python_utils.h"
+
+#if !defined(MSG_NOSIGNAL)
+// macOS has no per call flag, SO_NOSIGPIPE is set on the socket instead
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace python_worker {
+
+// File descriptor on which a worker process finds its end of the channel
+constexpr const int kWorkerChannelFd = 3;
+// File descriptors on which a spawned process finds the shared memory
+// regions of the inputs and outputs of its script
+constexpr const int kSharedBlobInputFd = 4;
+constexpr const int kSharedBlobOutputFd = 5;
+// File descriptor on which a spawned process finds its inline source
+constexpr const int kInlineCodeFd = 6;
+// Upper bound of descriptors passed along with a single message
+constexpr const int kMaxFdsPerMessage = 8;
+// Startup option of child processes naming the bytecode cache directory
+constexpr const char* kBytecodeCacheDirArg = "--bytecode-cache-dir=";
+// Startup option of child processes skipping the interpreter teardown
+constexpr const char* kFastExitArg = "--fast-exit";
+// Startup option of spawned processes reporting the imports of their script
+constexpr const char* kProfileImportsArg = "--profile-imports";
+// Startup option of spawned processes sharing blobs with their script
+constexpr const char* kSharedBlobsArg = "--shared-blobs";
+// Startup option of spawned processes running inline source
+constexpr const char* kInlineCodeArg = "--inline-code";
+// Startup option of spawned processes naming the cgroup they join before
+// starting Python
+constexpr const char* kCgroupArg = "--cgroup=";
+// Exit code of spawned processes which failed to join their cgroup
+constexpr const int kCgroupJoinFailedExitCode = 125;
+
+// Newline delimited JSON messages over a stream socket shared by the engine
+// and a worker process, optionally carrying file descriptors. Writes never
+// raise SIGPIPE, a peer that went away is reported as a failed Send/Receive
+// instead.
+class MessageChannel {
+ public:
+  explicit MessageChannel(int fd) : fd_(fd) {
+#if defined(__APPLE__)
+    int on = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  }
+
+  int fd() const { return fd_; }
+
+  bool Send(const Json::Value& message) { return Send(message, {}); }
+
+  // Sends `message` along with duplicates of `fds` for the peer. Only one
+  // message carrying descriptors may be in flight on a channel at a time.
+  bool Send(const Json::Value& message, const std::vector<int>& fds) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string line = Json::writeString(builder, message) + "\n";
+
+    size_t sent = 0;
+    while (sent < line.size()) {
+      struct iovec iov;
+      iov.iov_base = const_cast<char*>(line.data() + sent);
+      iov.iov_len = line.size() - sent;
+
+      struct msghdr msg = {};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+
+      std::vector<char> control;
+      if (sent == 0 && !fds.empty()) {
+        control.resize(CMSG_SPACE(sizeof(int) * fds.size()));
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+      }
+
+      ssize_t n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      sent += n;
+    }
+    return true;
+  }
+
+  bool Receive(Json::Value& message) {
+    std::vector<int> fds;
+    bool received = Receive(message, fds);
+    for (int fd : fds) {
+      close(fd);
+    }
+    return received;
+  }
+
+  // Receives the next message and the descriptors that came with it
+  bool Receive(Json::Value& message, std::vector<int>& fds) {
+    size_t pos;
+    while ((pos = buffer_.find('\n')) == std::string::npos) {
+      char chunk[4096];
+      struct iovec iov;
+      iov.iov_base = chunk;
+      iov.iov_len = sizeof(chunk);
+
+      alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFdsPerMessage)];
+      struct msghdr msg = {};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      ssize_t n = recvmsg(fd_, &msg, 0);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+
+      for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+          size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          const int* received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+          for (size_t i = 0; i < count; i++) {
+            fcntl(received[i], F_SETFD, FD_CLOEXEC);
+            fds.push_back(received[i]);
+          }
+        }
+      }
+      buffer_.append(chunk, n);
+    }
+
+    return PopMessage(message);
+  }
+
+  // Reads whatever is available without blocking, for channels driven by an
+  // event loop. Returns false once the peer closed the channel.
+  bool ReadAvailable() {
+    char chunk[4096];
+    while (true) {
+      ssize_t n = recv(fd_, chunk, sizeof(chunk), MSG_DONTWAIT);
+      if (n > 0) {
+        buffer_.append(chunk, n);
+        continue;
+      }
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+  }
+
+  // Takes the next complete message out of what was read so far
+  bool PopMessage(Json::Value& message) {
+    size_t pos = buffer_.find('\n');
+    if (pos == std::string::npos) {
+      return false;
+    }
+    std::string line = buffer_.substr(0, pos);
+    buffer_.erase(0, pos + 1);
+
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    return reader->parse(line.data(), line.data() + line.size(), &message, nullptr);
+  }
+
+ private:
+  int fd_;
+  std::string buffer_;
+};
+
+// Runtime a child process starts, handed over as its trailing arguments:
+// the library path, the shared library already resolved by the engine so
+// the child does not look for it again, then the startup profile options
+// and the execution options
+struct PythonRuntimeArgs {
+  std::string python_library_path;
+  std::string python_dynamic_lib_path;
+  python_utils::PythonStartupProfile startup_profile;
+  std::string bytecode_cache_dir;
+  // One-shot processes exit without finalizing the interpreter
+  bool fast_exit = false;
+  // Spawned processes profile the imports of their script and report them
+  // on kWorkerChannelFd, workers get it per job instead
+  bool profile_imports = false;
+  // Spawned processes find the shared blobs of their script on
+  // kSharedBlobInputFd and kSharedBlobOutputFd, workers get them per job
+  bool shared_blobs = false;
+  // Spawned processes read their script from kInlineCodeFd, workers get it
+  // per job
+  bool inline_code = false;
+  // Spawned processes with resource limits join this cgroup first
+  std::string cgroup_path;
+
+  void AppendTo(std::vector<std::string>& args) const {
+    std::vector<std::string> profile_args = startup_profile.ToArgs();
+    if (bytecode_cache_dir != "") profile_args.push_back(kBytecodeCacheDirArg + bytecode_cache_dir);
+    if (fast_exit) profile_args.push_back(kFastExitArg);
+    if (profile_imports) profile_args.push_back(kProfileImportsArg);
+    if (shared_blobs) profile_args.push_back(kSharedBlobsArg);
+    if (inline_code) profile_args.push_back(kInlineCodeArg);
+    if (cgroup_path != "") profile_args.push_back(kCgroupArg + cgroup_path);
+    if (python_library_path != "" || python_dynamic_lib_path != "" || !profile_args.empty())
+        args.push_back(python_library_path);
+    if (python_dynamic_lib_path != "" || !profile_args.empty())
+        args.push_back(python_dynamic_lib_path);
+    args.insert(args.end(), profile_args.begin(), profile_args.end());
+  }
+
+  // Reads the arguments of AppendTo, from `argv[first]` on
+  static PythonRuntimeArgs FromArgv(int argc, char** argv, int first) {
+    PythonRuntimeArgs runtime;
+    if (argc > first) runtime.python_library_path = argv[first];
+    if (argc > first + 1) runtime.python_dynamic_lib_path = argv[first + 1];
+    for (int i = first + 2; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg.rfind(kBytecodeCacheDirArg, 0) == 0) {
+        runtime.bytecode_cache_dir = arg.substr(strlen(kBytecodeCacheDirArg));
+      } else if (arg == kFastExitArg) {
+        runtime.fast_exit = true;
+      } else if (arg == kProfileImportsArg) {
+        runtime.profile_imports = true;
+      } else if (arg == kSharedBlobsArg) {
+        runtime.shared_blobs = true;
+      } else if (arg == kInlineCodeArg) {
+        runtime.inline_code = true;
+      } else if (arg.rfind(kCgroupArg, 0) == 0) {
+        runtime.cgroup_path = arg.substr(strlen(kCgroupArg));
+      } else if (!runtime.startup_profile.ParseArg(arg)) {
+        LOG_WARN << "Ignoring unknown startup option " << argv[i];
+      }
+    }
+    return runtime;
+  }
+};
+
+// Anonymous memory file for data handed to child processes, or an unlinked
+// temporary file where there is no memfd. It can be sealed when `sealable`
+// is set and memfd supports it. Kept above the descriptors spawned processes
+// get theirs on, so mapping one never overwrites another. Returns -1 with
+// errno set on failure.
+inline int CreateSharedMemoryFd(const char* name, bool sealable = false) {
+#if defined(__linux__)
+  int fd = memfd_create(name, MFD_CLOEXEC | (sealable ? MFD_ALLOW_SEALING : 0));
+#else
+  const char* tmp_dir = getenv("TMPDIR");
+  std::string path = std::string(tmp_dir && *tmp_dir ? tmp_dir : "/tmp") + "/" + name + "-XXXXXX";
+  int fd = mkstemp(path.data());
+  if (fd >= 0) {
+    unlink(path.c_str());
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  if (fd >= 0 && fd <= kInlineCodeFd) {
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, kInlineCodeFd + 1);
+    close(fd);
+    fd = moved;
+  }
+  return fd;
+}
+
+// Spawns `exe_path` with `args`, a channel on kWorkerChannelFd and the
+// descriptors of `fd_mappings`. Returns the engine end of the channel, or -1
+// on failure.
+inline int SpawnWithChannel(const std::string& exe_path,
+                            const std::vector<std::string>& args,
+                            process_spawn::SpawnStrategy strategy,
+                            pid_t& pid,
+                            std::vector<process_spawn::FdMapping> fd_mappings = {}) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    return -1;
+  }
+  // Only the process we are about to spawn may inherit its end of the channel
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  // Mapped last, it must not sit where an earlier mapping lands
+  if (fds[1] >= kWorkerChannelFd && fds[1] <= kInlineCodeFd) {
+    int moved = fcntl(fds[1], F_DUPFD_CLOEXEC, kInlineCodeFd + 1);
+    close(fds[1]);
+    fds[1] = moved;
+  }
+
+  fd_mappings.push_back({fds[1], kWorkerChannelFd});
+  int status = process_spawn::SpawnProcess(strategy, exe_path, args, fd_mappings, pid);
+  close(fds[1]);
+
+  if (status) {
+    close(fds[0]);
+    errno = status;
+    return -1;
+  }
+  return fds[0];
+}
+
+} // namespace python_worker
+
+#endif
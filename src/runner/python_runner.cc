@@ -0,0 +1,24 @@
+// Minimal executable for the child processes of the engine. It only embeds
+// the Python runtime, so spawning it skips loading the engine library and
+// building a server.
+#include <string>
+
+#include "src/python_utils.h"
+#include "src/python_worker.h"
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s --run_python_file <file> [python_library_path [python_dynamic_lib [startup_options...]]]\n"
+            "       %s --run_python_worker [python_library_path [python_dynamic_lib [startup_options...]]]\n"
+            "       %s --run_python_zygote [python_library_path [python_dynamic_lib [startup_options...]]]\n",
+            argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  // The runner is installed in engines/cortex.python/, next to the default library
+  std::string exe_path = python_utils::getCurrentExecutablePath();
+  std::string default_py_lib_path = python_utils::GetDirectoryPathFromFilePath(exe_path) + "python/";
+
+  return python_worker::RunPythonChildProcess(default_py_lib_path, argc, argv);
+}